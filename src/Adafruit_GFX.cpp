@@ -69,6 +69,23 @@ using std::swap;
 #define pgm_read_pointer(addr) ((void *)pgm_read_word(addr))
 #endif
 
+// The classic font as 6 column bytes per glyph, the 5 font columns then
+// the blank spacing column, so size 1 characters are drawn whole with
+// drawColumns(). Built once from glcdfont.c, missing glyphs are blank.
+static struct GlyphAtlas {
+  uint8_t cols[256][6];
+
+  GlyphAtlas()
+  {
+    const int glyphs = sizeof(font) / 5;
+    for (int c = 0; c < 256; c++) {
+      for (int i = 0; i < 5; i++)
+        cols[c][i] = (c < glyphs) ? font[c * 5 + i] : 0;
+      cols[c][5] = 0;
+    }
+  }
+} classic_glyphs;
+
 void Adafruit_GFX::reset(int16_t w, int16_t h)
 {
   _width = w;
@@ -209,6 +226,26 @@ void Adafruit_GFX::fillRect(int16_t x, int16_t y, int16_t w, int16_t h,
   endWrite();
 }
 
+void Adafruit_GFX::drawColumns(int16_t x, int16_t y, const uint8_t *cols,
+                               int16_t w, uint8_t h, uint16_t color,
+                               uint16_t bg)
+{
+  // Update in subclasses if desired!
+  if (h > 8)
+    h = 8;
+  startWrite();
+  for (int16_t i = 0; i < w; i++) {
+    uint8_t line = cols[i];
+    for (int8_t j = 0; j < h; j++, line >>= 1) {
+      if (line & 1)
+        writePixel(x + i, y + j, color);
+      else if (bg != color)
+        writePixel(x + i, y + j, bg);
+    }
+  }
+  endWrite();
+}
+
 void Adafruit_GFX::fillScreen(uint16_t color)
 {
   // Update in subclasses if desired!
@@ -796,6 +833,17 @@ void Adafruit_GFX::drawCharPart(int16_t x, int16_t y, int x_off_start,
     if (!_cp437 && (c >= 176))
       c++; // Handle 'classic' charset behavior
 
+    if (size == 1) { // Whole columns from the glyph atlas
+      if (x_off_start < 0)
+        x_off_start = 0;
+      if (x_off_end > 6)
+        x_off_end = 6;
+      if (x_off_start < x_off_end)
+        drawColumns(x + x_off_start, y, classic_glyphs.cols[c] + x_off_start,
+                    x_off_end - x_off_start, 8, color, bg);
+      return;
+    }
+
     startWrite();
     for (int8_t i = 0; i < 6; i++) {              // Char bitmap = 5 columns
       int x_off_pix_start = i * size;             // unclipped start
@@ -865,6 +913,11 @@ void Adafruit_GFX::drawChar(int16_t x, int16_t y, unsigned char c,
     if (!_cp437 && (c >= 176))
       c++; // Handle 'classic' charset behavior
 
+    if (size == 1) { // Whole columns from the glyph atlas
+      drawColumns(x, y, classic_glyphs.cols[c], 6, 8, color, bg);
+      return;
+    }
+
     startWrite();
     for (int8_t i = 0; i < 5; i++) { // Char bitmap = 5 columns
       uint8_t line = pgm_read_byte(&font[c * 5 + i]);
@@ -1009,6 +1062,13 @@ void Adafruit_GFX::write(uint8_t c)
 #endif
 }
 
+const uint8_t *Adafruit_GFX::getGlyphColumns(unsigned char c) const
+{
+  if (!_cp437 && (c >= 176))
+    c++; // Handle 'classic' charset behavior
+  return classic_glyphs.cols[c];
+}
+
 void Adafruit_GFX::setCursor(int16_t x, int16_t y)
 {
   cursor_x = x;
@@ -47,6 +47,12 @@ public:
       drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color),
       drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
 
+  // Draw w columns of h (at most 8) pixels from column bytes, bit 0 at the
+  // top, in color, and the clear bits in bg if it differs from color.
+  // MAY be overridden to combine whole bytes into a paged buffer.
+  virtual void drawColumns(int16_t x, int16_t y, const uint8_t *cols,
+                           int16_t w, uint8_t h, uint16_t color, uint16_t bg);
+
   // These exist only with Adafruit_GFX (no subclass overrides)
   void drawCircle(int16_t x0, int16_t y0, int16_t r, uint16_t color),
       drawCircleHelper(int16_t x0, int16_t y0, int16_t r, uint8_t cornername,
@@ -105,6 +111,9 @@ public:
   virtual void write(uint8_t);
 #endif
 
+  // Columns of a classic font character, 6 bytes with bit 0 at the top
+  const uint8_t *getGlyphColumns(unsigned char c) const;
+
   int16_t height(void) const;
   int16_t width(void) const;
 
@@ -35,9 +35,12 @@ redistribution
 *********************************************************************/
 
 #include "./ArduiPi_OLED.h"
+#include "./OLED_Format.h"
 #include "./Adafruit_GFX.h"
 #include "./ArduiPi_OLED_lib.h"
 
+#include <math.h>
+
 const char *oled_type_str[] = {"Adafruit SPI 128x32", "Adafruit SPI 128x64",
                                "Adafruit I2C 128x32", "Adafruit I2C 128x64",
                                "Seeed I2C 128x64",    "Seeed I2C 96x96",
@@ -147,79 +150,131 @@ const unsigned char seedfont[][8] = {
     {0x00, 0x02, 0x01, 0x01, 0x02, 0x01, 0x00, 0x00},
     {0x00, 0x02, 0x05, 0x05, 0x02, 0x00, 0x00, 0x00}};
 
-inline boolean ArduiPi_OLED::isSPI(void) { return (cs != -1 ? true : false); }
-inline boolean ArduiPi_OLED::isI2C(void) { return (cs == -1 ? true : false); }
-// Low level I2C and SPI Write function
-inline void ArduiPi_OLED::fastSPIwrite(uint8_t d) { bcm2835_spi_transfer(d); }
-inline void ArduiPi_OLED::fastI2Cwrite(uint8_t d) { bcm2835_spi_transfer(d); }
-inline void ArduiPi_OLED::fastSPIwrite(char *tbuf, uint32_t len)
+inline boolean ArduiPi_OLED::isSPI(void) { return transport->isSPI(); }
+
+// Drawing functions compiled for the buffer format of the panel, or of
+// the canvas
+void ArduiPi_OLED::selectOps(void)
 {
-  bcm2835_spi_writenb(tbuf, len);
+  if (oled_type == OLED_SEEED_I2C_96x96)
+    ops = &OLED_Draw<OLED_Gray96_Format>::ops;
+  else if (oled_height == 32)
+    ops = pcanvas ? &OLED_Draw<OLED_Row_Format<128, 32> >::ops
+                  : &OLED_Draw<OLED_Paged_Format<128, 32> >::ops;
+  else
+    ops = pcanvas ? &OLED_Draw<OLED_Row_Format<128, 64> >::ops
+                  : &OLED_Draw<OLED_Paged_Format<128, 64> >::ops;
 }
-inline void ArduiPi_OLED::fastI2Cwrite(char *tbuf, uint32_t len)
+
+// Buffer and lit pixel nibbles for the drawing functions
+inline OLED_Frame ArduiPi_OLED::drawTarget(void)
 {
-  bcm2835_i2c_alt_write(tbuf, len);
+  OLED_Frame f = {pcanvas ? pcanvas : poledbuff, (uint8_t)(grayH << 4),
+                  grayL};
+  return f;
 }
 
 // the most basic function, set a single pixel
 void ArduiPi_OLED::drawPixel(int16_t x, int16_t y, uint16_t color)
 {
-  uint8_t *p = poledbuff;
-  uint8_t c;
-
-  if ((x < 0) || (x >= width()) || (y < 0) || (y >= height()))
-    return;
+  ops->drawPixel(drawTarget(), x, y, color);
+}
 
-  /*
-  // check rotation, move pixel around if necessary
-switch (getRotation())
+void ArduiPi_OLED::writeLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1,
+                             uint16_t color)
 {
-  case 1:
-    swap(x, y);
-    x = WIDTH - x - 1;
-  break;
+  ops->writeLine(drawTarget(), x0, y0, x1, y1, color);
+}
 
-  case 2:
-    x = WIDTH - x - 1;
-    y = HEIGHT - y - 1;
-  break;
+// Columns are clipped here, then drawn by the format of the panel
+void ArduiPi_OLED::drawColumns(int16_t x, int16_t y, const uint8_t *cols,
+                               int16_t w, uint8_t h, uint16_t color,
+                               uint16_t bg)
+{
+  if (h > 8)
+    h = 8;
+
+  // Clip
+  if (x < 0) {
+    cols -= x;
+    w += x;
+    x = 0;
+  }
+  if (x + w > oled_width)
+    w = oled_width - x;
+  if (w <= 0 || h == 0 || y >= oled_height || y + h <= 0)
+    return;
 
-  case 3:
-    swap(x, y);
-    y = HEIGHT - y - 1;
-  break;
+  ops->drawColumns(drawTarget(), x, y, cols, w, h, color, bg);
 }
-*/
-  if (oled_type == OLED_SEEED_I2C_96x96) {
-    // Get where to do the change in the buffer
-    p = poledbuff + (x + (y / 2) * oled_width);
 
-    // Get old value to not touch the other nible
-    c = *p;
+// Fill an area with w and h above 0, clipped here, then filled by the
+// format of the panel
+void ArduiPi_OLED::fillArea(int16_t x, int16_t y, int16_t w, int16_t h,
+                            uint16_t color)
+{
+  int16_t x0 = (x < 0) ? 0 : x;
+  int16_t x1 = (x + w > oled_width) ? oled_width : x + w;
+  int16_t y0 = (y < 0) ? 0 : y;
+  int16_t y1 = (y + h > oled_height) ? oled_height : y + h;
+  if (x0 >= x1 || y0 >= y1)
+    return;
 
-    // We are on High nible ?
-    if (((y / 2) & 1) == 1) {
-      c &= 0x0F;
-      c |= (color == WHITE ? grayH : 0x00) << 4;
-    }
-    else {
-      c &= 0xF0;
-      c |= (color == WHITE ? grayL : 0x00);
-    }
+  ops->fillArea(drawTarget(), x0, y0, x1 - x0, y1 - y0, color);
+}
 
-    // set new nible value leaving the other untouched
-    *p = c;
+// Lines and rectangles are filled as areas. A line length below 1 runs
+// back from the start point, as with the Adafruit_GFX versions, which
+// draw these with writeLine().
+void ArduiPi_OLED::writeFastVLine(int16_t x, int16_t y, int16_t h,
+                                  uint16_t color)
+{
+  if (h < 1) {
+    y += h - 1;
+    h = 2 - h;
   }
-  else {
-    // Get where to do the change in the buffer
-    p = poledbuff + (x + (y / 8) * oled_width);
+  fillArea(x, y, 1, h, color);
+}
+
+void ArduiPi_OLED::writeFastHLine(int16_t x, int16_t y, int16_t w,
+                                  uint16_t color)
+{
+  if (w < 1) {
+    x += w - 1;
+    w = 2 - w;
+  }
+  fillArea(x, y, w, 1, color);
+}
 
-    // x is which column
-    if (color == WHITE)
-      *p |= _BV((y % 8));
-    else
-      *p &= ~_BV((y % 8));
+// A rectangle is a row of vertical lines, and so has no width below 1
+void ArduiPi_OLED::writeFillRect(int16_t x, int16_t y, int16_t w, int16_t h,
+                                 uint16_t color)
+{
+  if (w < 1)
+    return;
+  if (h < 1) {
+    y += h - 1;
+    h = 2 - h;
   }
+  fillArea(x, y, w, h, color);
+}
+
+void ArduiPi_OLED::drawFastVLine(int16_t x, int16_t y, int16_t h,
+                                 uint16_t color)
+{
+  writeFastVLine(x, y, h, color);
+}
+
+void ArduiPi_OLED::drawFastHLine(int16_t x, int16_t y, int16_t w,
+                                 uint16_t color)
+{
+  writeFastHLine(x, y, w, color);
+}
+
+void ArduiPi_OLED::fillRect(int16_t x, int16_t y, int16_t w, int16_t h,
+                            uint16_t color)
+{
+  writeFillRect(x, y, w, h, color);
 }
 
 // Display instantiation
@@ -227,16 +282,32 @@ ArduiPi_OLED::ArduiPi_OLED()
 {
   // Init all var, and clean
   // Command I/O
-  rst = 0;
-  dc = 0;
-  cs = 0;
+  transport = NULL;
 
   // Lcd size
   oled_width = 0;
   oled_height = 0;
+  ops = NULL;
 
   // Empty pointer to OLED buffer
   poledbuff = NULL;
+  pcanvas = NULL;
+  pshadowbuff = NULL;
+  pxferbuff = NULL;
+  shadow_valid = false;
+  bytes_saved = 0;
+  i2c_xfer_mode = OLED_I2C_XFER_FRAME;
+  damage_tracking = false;
+  hw_scroll.on = false;
+  hw_scroll.gen = 0;
+  hw_scroll_sent = hw_scroll;
+
+  // No flush thread
+  pframes = NULL;
+  frame_ready = 0;
+  pending_cmds = 0;
+  flush_quit = false;
+  flush_running = false;
 }
 
 // When not initialized program using this library may
@@ -265,6 +336,10 @@ boolean ArduiPi_OLED::select_oled(uint8_t OLED_TYPE, int8_t i2c_addr)
   _i2c_addr = 0x00;
   oled_type = OLED_TYPE;
 
+  // Send all changed pages in one message, unless the panel only has
+  // page addressing
+  i2c_xfer_mode = OLED_I2C_XFER_FRAME;
+
   // default OLED are using internal boost VCC converter
   vcc_type = SSD_Internal_Vcc;
 
@@ -300,9 +375,11 @@ boolean ArduiPi_OLED::select_oled(uint8_t OLED_TYPE, int8_t i2c_addr)
 
   case OLED_SH1106_I2C_128x64:
     _i2c_addr = SH1106_I2C_ADDRESS;
+    i2c_xfer_mode = OLED_I2C_XFER_PAGE;
     break;
 
-  case OLED_SH1106_SPI_128x64:;
+  case OLED_SH1106_SPI_128x64:
+    i2c_xfer_mode = OLED_I2C_XFER_PAGE;
     break;
 
   // houston, we have a problem
@@ -327,15 +404,23 @@ boolean ArduiPi_OLED::select_oled(uint8_t OLED_TYPE, int8_t i2c_addr)
   // De-Allocate memory for OLED buffer if any
   if (poledbuff)
     free(poledbuff);
-
-  // Allocate memory for OLED buffer
+  if (pshadowbuff)
+    free(pshadowbuff);
+  if (pxferbuff)
+    free(pxferbuff);
+  if (pcanvas)
+    free(pcanvas);
+  pcanvas = NULL;
+  selectOps();
+
+  // Allocate memory for OLED buffer, for a copy of what was last sent,
+  // and for the bytes to send (with a leading control byte)
   poledbuff = (uint8_t *)malloc(oled_buff_size);
+  pshadowbuff = (uint8_t *)malloc(oled_buff_size);
+  pxferbuff = (uint8_t *)malloc(oled_buff_size + 1);
+  shadow_valid = false;
 
-  if (!poledbuff)
-    return false;
-
-  // Init Raspberry PI GPIO
-  if (!bcm2835_init())
+  if (!poledbuff || !pshadowbuff || !pxferbuff)
     return false;
 
   return true;
@@ -346,81 +431,80 @@ boolean ArduiPi_OLED::select_oled(uint8_t OLED_TYPE, int8_t i2c_addr)
 boolean ArduiPi_OLED::init_spi(int8_t DC, int8_t RST, int8_t CS,
                                uint8_t OLED_TYPE)
 {
-  rst = RST; // Reset Pin
-  dc = DC;   // Data / command Pin
-  cs = CS;   // Raspberry SPI chip Enable (may be CE0 or CE1)
-
-  // Select OLED parameters
-  if (!select_oled(OLED_TYPE))
-    return false;
-
-  // Init & Configure Raspberry PI SPI
-  bcm2835_spi_begin();
-  bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);
-  bcm2835_spi_setDataMode(BCM2835_SPI_MODE0);
-  bcm2835_spi_chipSelect(cs);
-
-  // 16 MHz SPI bus, but Worked at 62 MHz also
-  bcm2835_spi_setClockDivider(BCM2835_SPI_CLOCK_DIVIDER_16);
-
-  // Set the pin that will control DC as output
-  bcm2835_gpio_fsel(dc, BCM2835_GPIO_FSEL_OUTP);
-
-  // Setup reset pin direction as output
-  bcm2835_gpio_fsel(rst, BCM2835_GPIO_FSEL_OUTP);
-
-  return (true);
+  return init_transport(new OLED_SPI_Transport(DC, RST, CS), OLED_TYPE);
 }
 
 // initializer for I2C - we only indicate the reset pin and OLED type !
 boolean ArduiPi_OLED::init_i2c(int8_t RST, uint8_t OLED_TYPE, int8_t i2c_addr,
                                int i2c_bus)
 {
-  dc = cs = -1; // DC and chip Select do not exist in I2C
-  rst = RST;
-
-  // Select OLED parameters
-  if (!select_oled(OLED_TYPE, i2c_addr))
-    return false;
-
-  // Init & Configure Raspberry PI I2C
-  if (bcm2835_i2c_alt_begin(i2c_bus) == 0)
-    return false;
+  return init_transport(new OLED_I2C_Transport(RST, i2c_bus), OLED_TYPE,
+                        i2c_addr);
+}
 
-  bcm2835_i2c_alt_setSlaveAddress(_i2c_addr);
+// initializer for a virtual panel, no hardware is used, the bus is
+// modelled as SPI or I2C according to the OLED type
+boolean ArduiPi_OLED::init_virtual(uint8_t OLED_TYPE, uint32_t clock_hz,
+                                   const char *pbm_path)
+{
+  boolean spi = oled_is_spi_proto(OLED_TYPE);
+  return init_transport(
+      new OLED_Virtual_Transport(OLED_TYPE, spi, clock_hz, pbm_path),
+      OLED_TYPE);
+}
 
-  // Set clock to 400 KHz
-  // does not seem to work, will check this later
-  // bcm2835_i2c_alt_set_baudrate(400000);
+// initializer with a transport, which is deleted in close()
+boolean ArduiPi_OLED::init_transport(OLED_Transport *trans, uint8_t OLED_TYPE,
+                                     int8_t i2c_addr)
+{
+  delete transport;
+  transport = trans;
 
-  // Setup reset pin direction as output
-  bcm2835_gpio_fsel(rst, BCM2835_GPIO_FSEL_OUTP);
+  // Select OLED parameters
+  if (!transport || !select_oled(OLED_TYPE, i2c_addr))
+    return false;
 
-  return (true);
+  // Init & Configure the bus
+  transport->setI2CAddress(_i2c_addr);
+  return transport->begin();
 }
 
 void ArduiPi_OLED::close(void)
 {
+  // Send any waiting frame, and stop sending from a separate thread
+  stopFlushThread();
+
   // De-Allocate memory for OLED buffer if any
   if (poledbuff)
     free(poledbuff);
+  if (pshadowbuff)
+    free(pshadowbuff);
+  if (pxferbuff)
+    free(pxferbuff);
+  if (pcanvas)
+    free(pcanvas);
 
   poledbuff = NULL;
-
-  // Release Raspberry SPI
-  if (isSPI())
-    bcm2835_spi_end();
-
-  // Release Raspberry I2C
-  if (isI2C())
-    bcm2835_i2c_alt_end();
-
-  // Release Raspberry I/O control
-  bcm2835_close();
+  pshadowbuff = NULL;
+  pxferbuff = NULL;
+  pcanvas = NULL;
+  shadow_valid = false;
+
+  // Release the bus
+  if (transport) {
+    transport->end();
+    delete transport;
+    transport = NULL;
+  }
 }
 
 void ArduiPi_OLED::reset_offset()
 {
+  if (flush_running) { // send from the flush thread
+    pending_cmds |= CMD_RESET_OFFSET;
+    sem_post(&flush_sem);
+    return;
+  }
   sendCommand(SSD1306_Set_Display_Offset, 0x00);        // no offset
 }
 
@@ -434,21 +518,20 @@ void ArduiPi_OLED::begin(void)
 
   reset(oled_width, oled_height);
 
-  // Setup reset pin direction (used by both SPI and I2C)
-  bcm2835_gpio_fsel(rst, BCM2835_GPIO_FSEL_OUTP);
-  bcm2835_gpio_write(rst, HIGH);
+  // Reset pin (used by both SPI and I2C)
+  transport->setReset(HIGH);
 
   // VDD (3.3V) goes high at start, lets just chill for a ms
   usleep(1000);
 
   // bring reset low
-  bcm2835_gpio_write(rst, LOW);
+  transport->setReset(LOW);
 
   // wait 10ms
   usleep(10000);
 
   // bring out of reset
-  bcm2835_gpio_write(rst, HIGH);
+  transport->setReset(HIGH);
 
   // depends on OLED type configuration
   if (oled_height == 32) {
@@ -589,9 +672,12 @@ void ArduiPi_OLED::begin(void)
   sendCommand(SSD_Set_ContrastLevel, contrast);
 
   stopscroll();
+  hw_scroll.on = false;
+  hw_scroll_sent.on = false;
 
-  // Empty uninitialized buffer
+  // Empty uninitialized buffer, OLED memory contents are unknown
   clearDisplay();
+  shadow_valid = false;
 
   // turn on oled panel
   sendCommand(SSD_Display_On);
@@ -660,6 +746,16 @@ void ArduiPi_OLED::setBrightness(uint8_t Brightness)
 
 void ArduiPi_OLED::invertDisplay(uint8_t i)
 {
+  if (flush_running) { // send from the flush thread
+    uint8_t cmd = i ? CMD_INVERT : CMD_NORMAL;
+    uint8_t cmds = pending_cmds;
+    while (!pending_cmds.compare_exchange_weak(
+        cmds, (cmds & ~(CMD_INVERT | CMD_NORMAL)) | cmd))
+      ;
+    sem_post(&flush_sem);
+    return;
+  }
+
   if (i)
     sendCommand(SSD_Inverse_Display);
   else
@@ -667,77 +763,18 @@ void ArduiPi_OLED::invertDisplay(uint8_t i)
                                                   : SSD1306_Normal_Display);
 }
 
-void ArduiPi_OLED::sendCommand(uint8_t c)
-{
-  // Is SPI
-  if (isSPI()) {
-    // Setup D/C line to low to switch to command mode
-    bcm2835_gpio_write(dc, LOW);
-
-    // Write Data on SPI
-    fastSPIwrite(c);
-  }
-  // so I2C
-  else {
-    char buff[2];
-
-    // Clear D/C to switch to command mode
-    buff[0] = SSD_Command_Mode;
-    buff[1] = c;
-
-    // Write Data on I2C
-    fastI2Cwrite(buff, sizeof(buff));
-  }
-}
+void ArduiPi_OLED::sendCommand(uint8_t c) { transport->sendCommands(&c, 1); }
 
 void ArduiPi_OLED::sendCommand(uint8_t c0, uint8_t c1)
 {
-  char buff[3];
-  buff[1] = c0;
-  buff[2] = c1;
-
-  // Is SPI
-  if (isSPI()) {
-    // Setup D/C line to low to switch to command mode
-    bcm2835_gpio_write(dc, LOW);
-
-    // Write Data
-    fastSPIwrite(&buff[1], 2);
-  }
-  // I2C
-  else {
-    // Clear D/C to switch to command mode
-    buff[0] = SSD_Command_Mode;
-
-    // Write Data on I2C
-    fastI2Cwrite(buff, 3);
-  }
+  uint8_t buff[2] = {c0, c1};
+  transport->sendCommands(buff, sizeof(buff));
 }
 
 void ArduiPi_OLED::sendCommand(uint8_t c0, uint8_t c1, uint8_t c2)
 {
-  char buff[4];
-
-  buff[1] = c0;
-  buff[2] = c1;
-  buff[3] = c2;
-
-  // Is SPI
-  if (isSPI()) {
-    // Setup D/C line to low to switch to command mode
-    bcm2835_gpio_write(dc, LOW);
-
-    // Write Data
-    fastSPIwrite(&buff[1], 3);
-  }
-  // I2C
-  else {
-    // Clear D/C to switch to command mode
-    buff[0] = SSD_Command_Mode;
-
-    // Write Data on I2C
-    fastI2Cwrite(buff, sizeof(buff));
-  }
+  uint8_t buff[3] = {c0, c1, c2};
+  transport->sendCommands(buff, sizeof(buff));
 }
 
 // startscrollright
@@ -833,116 +870,435 @@ void ArduiPi_OLED::stopscroll(void) { sendCommand(SSD_Deactivate_Scroll); }
 
 void ArduiPi_OLED::sendData(uint8_t c)
 {
-  // SPI
-  if (isSPI()) {
-    // SPI
-    // Setup D/C line to high to switch to data mode
-    bcm2835_gpio_write(dc, HIGH);
+  uint8_t buff[2]; // leave room for the I2C control byte
+  buff[1] = c;
+  transport->sendData(buff, 1, true);
+}
 
-    // write value
-    fastSPIwrite(c);
+// Set the OLED memory window that the next data bytes will be written to.
+// A page is 8 rows of 1 bit pixels, or for the Seeed 96x96 one driver
+// column of 2 nibble pixels (vertical mode), either way oled_width bytes.
+// SH1106 only has page addressing, so page_end is ignored.
+void ArduiPi_OLED::setWindow(uint8_t page_start, uint8_t page_end,
+                             uint8_t col_start, uint8_t col_end)
+{
+  if (oled_type == OLED_SEEED_I2C_96x96) {
+    sendCommand(SSD1327_Set_Column_Address, 0x08 + page_start,
+                0x08 + page_end);
+    sendCommand(SSD1327_Set_Row_Address, col_start, col_end);
+  }
+  else if (oled_type == OLED_SH1106_I2C_128x64 ||
+           oled_type == OLED_SH1106_SPI_128x64) {
+    // RAM is 132 wide, display starts at column 2
+    uint8_t col = col_start + 2;
+    sendCommand(SH1106_Set_Page_Address + page_start);
+    sendCommand(SSD1306_Set_Lower_Column_Start_Address | (col & 0x0F));
+    sendCommand(SSD1306_Set_Higher_Column_Start_Address | (col >> 4));
   }
-  // I2C
   else {
-    char buff[2];
+    // Horizontal addressing mode, set in begin()
+    sendCommand(SSD_Set_Column_Address, col_start, col_end);
+    sendCommand(SSD_Set_Page_Address, page_start, page_end);
+  }
+}
+
+// Send len data bytes, held after the control byte in the transfer buffer,
+// to the current OLED memory window
+void ArduiPi_OLED::sendXferBuff(uint16_t len)
+{
+  transport->sendData(pxferbuff, len, i2c_xfer_mode == OLED_I2C_XFER_CHUNK);
+}
+
+// Send the buffer to the OLED, or if the flush thread is running then
+// hand over a copy of the buffer to be sent.
+void ArduiPi_OLED::display(void)
+{
+  if (!damage_tracking)
+    damageAll(damage);
+
+  // Convert the damaged pages of the canvas
+  if (pcanvas) {
+    const int16_t stride = oled_width / 8;
+    for (int16_t page = 0; page < oled_height / 8; page++)
+      if (damage.lo[page] <= damage.hi[page])
+        OLED_Rows_To_Page(pcanvas + page * 8 * stride,
+                          poledbuff + page * oled_width, oled_width);
+  }
 
-    // Setup D/C to switch to data mode
-    buff[0] = SSD_Data_Mode;
-    buff[1] = c;
+  if (!flush_running) {
+    transmit(poledbuff, damage, hw_scroll);
+    clearDamage(damage);
+    return;
+  }
 
-    // Write on i2c
-    fastI2Cwrite(buff, sizeof(buff));
+  uint8_t *frame = pframes + frame_back * oled_buff_size;
+  memcpy(frame, poledbuff, oled_buff_size);
+
+  // A frame may be replaced before it is sent, so its damage includes
+  // the damage of the frames published since the last one taken
+  Damage &dmg = frame_damage[frame_back];
+  dmg = damage_carry;
+  mergeDamage(dmg, damage);
+  frame_hw_scroll[frame_back] = hw_scroll;
+
+  // Publish the frame, replacing any frame that has not been sent yet,
+  // and take the buffer it was in (or the last sent one) to fill next.
+  uint8_t last = frame_ready.exchange(frame_back | FRAME_FRESH);
+  damage_carry = (last & FRAME_FRESH) ? dmg : damage;
+  frame_back = last & FRAME_IDX;
+  clearDamage(damage);
+  sem_post(&flush_sem);
+}
+
+void ArduiPi_OLED::setDamageTracking(boolean on)
+{
+  damage_tracking = on;
+  clearDamage(damage);
+}
+
+boolean ArduiPi_OLED::hasHardwareScroll(void)
+{
+  switch (oled_type) {
+  case OLED_ADAFRUIT_SPI_128x32:
+  case OLED_ADAFRUIT_SPI_128x64:
+  case OLED_ADAFRUIT_I2C_128x32:
+  case OLED_ADAFRUIT_I2C_128x64:
+  case OLED_SEEED_I2C_128x64:
+    return true;
   }
+  return false;
 }
 
-void ArduiPi_OLED::display(void)
+// Scroll interval, as a Scroll_ value, nearest to pixels_per_sec, and
+// the rate it gives. The OLED frame rate is estimated from the typical
+// oscillator frequency, and the precharge and multiplex set in begin().
+uint8_t ArduiPi_OLED::scrollInterval(float pixels_per_sec, float *rate)
 {
+  const uint16_t frames[] = {2, 3, 4, 5, 25, 64, 128, 256};
+  const uint8_t intervals[] = {Scroll_2Frames,  Scroll_3Frames,
+                               Scroll_4Frames,  Scroll_5Frames,
+                               Scroll_25Frames, Scroll_64Frames,
+                               Scroll_128Frames, Scroll_256Frames};
+  const float osc_hz = 370000;
+  const uint8_t precharge = (vcc_type == SSD_External_Vcc) ? 0x22 : 0xF1;
+  const float frame_hz =
+      osc_hz / (((precharge & 0x0F) + (precharge >> 4) + 50) * oled_height);
+
+  int best = 0;
+  for (int i = 1; i < 8; i++)
+    if (fabs(log(frame_hz / frames[i] / pixels_per_sec)) <
+        fabs(log(frame_hz / frames[best] / pixels_per_sec)))
+      best = i;
+  *rate = frame_hz / frames[best];
+  return intervals[best];
+}
 
-  if (oled_type == OLED_SEEED_I2C_96x96) {
-    sendCommand(SSD1327_Set_Row_Address, 0x00, 0x5F);
-    sendCommand(SSD1327_Set_Column_Address, 0x08, 0x37);
+float ArduiPi_OLED::getHardwareScrollRate(float pixels_per_sec)
+{
+  float rate;
+  scrollInterval(pixels_per_sec, &rate);
+  return rate;
+}
+
+boolean ArduiPi_OLED::setHardwareScroll(uint8_t page_start, uint8_t page_end,
+                                        float pixels_per_sec)
+{
+  if (!hasHardwareScroll())
+    return false;
+  float rate;
+  hw_scroll.on = true;
+  hw_scroll.page_start = page_start;
+  hw_scroll.page_end = page_end;
+  hw_scroll.interval = scrollInterval(pixels_per_sec, &rate);
+  hw_scroll.gen++;
+  return true;
+}
+
+void ArduiPi_OLED::stopHardwareScroll(void) { hw_scroll.on = false; }
+
+boolean ArduiPi_OLED::setCanvasMode(boolean on)
+{
+  if (on == (pcanvas != NULL))
+    return true;
+
+  const int16_t stride = oled_width / 8;
+  if (on) {
+    if (oled_type == OLED_SEEED_I2C_96x96 || !poledbuff)
+      return false;
+    pcanvas = (uint8_t *)malloc(oled_buff_size);
+    if (!pcanvas)
+      return false;
+    // Start from the current picture
+    for (int16_t page = 0; page < oled_height / 8; page++)
+      OLED_Page_To_Rows(poledbuff + page * oled_width,
+                        pcanvas + page * 8 * stride, oled_width);
   }
   else {
-    sendCommand(SSD1306_Set_Lower_Column_Start_Address | 0x0);  // low col = 0
-    sendCommand(SSD1306_Set_Higher_Column_Start_Address | 0x0); // hi col = 0
-    sendCommand(SSD1306_Set_Start_Line | 0x0);                  // line #0
-  }
-
-  uint16_t i = 0;
-
-  // pointer to OLED data buffer
-  uint8_t *p = poledbuff;
-
-  // SPI
-  if (isSPI()) {
-    // Setup D/C line to high to switch to data mode
-    bcm2835_gpio_write(dc, HIGH);
-    if (oled_type == OLED_SH1106_SPI_128x64) {
-      char buff[17];
-      uint8_t x;
-      buff[0] = SSD_Data_Mode;
-      for (uint8_t k = 0; k < 8; k++) {
-        sendCommand(0xB0 + k); // set page addressSSD_Data_Mode;
-        sendCommand(0x02);     // set lower column address
-        sendCommand(0x10);     // set higher column address
-        bcm2835_gpio_write(dc, HIGH);
-
-        for (i = 0; i < 8; i++) {
-          for (x = 1; x <= 16; x++)
-            buff[x] = *p++;
-
-          fastSPIwrite(&buff[1], 16);
-        }
-      }
-    }
-    else {
-      // Send all data to OLED
-      for (i = 0; i < oled_buff_size; i++) {
-        fastSPIwrite(*p++);
-      }
-
-      // I wonder why we have to do this (check datasheet)
-      if (oled_height == 32) {
-        for (uint16_t i = 0; i < oled_buff_size; i++) {
-          fastSPIwrite(0);
-        }
-      }
+    // Keep the current picture
+    for (int16_t page = 0; page < oled_height / 8; page++)
+      OLED_Rows_To_Page(pcanvas + page * 8 * stride,
+                        poledbuff + page * oled_width, oled_width);
+    free(pcanvas);
+    pcanvas = NULL;
+  }
+
+  selectOps();
+  return true;
+}
+
+void ArduiPi_OLED::addDamage(int16_t x, int16_t y, int16_t w, int16_t h)
+{
+  int16_t x0 = (x < 0) ? 0 : x;
+  int16_t x1 = (x + w > oled_width) ? oled_width - 1 : x + w - 1;
+  int16_t y0 = (y < 0) ? 0 : y;
+  int16_t y1 = (y + h > oled_height) ? oled_height - 1 : y + h - 1;
+  if (x0 > x1 || y0 > y1)
+    return;
+
+  const int16_t rows_per_page = oled_height * oled_width / oled_buff_size;
+  for (int16_t page = y0 / rows_per_page; page <= y1 / rows_per_page;
+       page++) {
+    if (x0 < damage.lo[page])
+      damage.lo[page] = x0;
+    if (x1 > damage.hi[page])
+      damage.hi[page] = x1;
+  }
+}
+
+void ArduiPi_OLED::clearDamage(Damage &dmg)
+{
+  for (int page = 0; page < MAX_PAGES; page++) {
+    dmg.lo[page] = oled_width;
+    dmg.hi[page] = -1;
+  }
+}
+
+void ArduiPi_OLED::damageAll(Damage &dmg)
+{
+  for (int page = 0; page < MAX_PAGES; page++) {
+    dmg.lo[page] = 0;
+    dmg.hi[page] = oled_width - 1;
+  }
+}
+
+void ArduiPi_OLED::mergeDamage(Damage &dmg, const Damage &from)
+{
+  for (int page = 0; page < MAX_PAGES; page++) {
+    if (from.lo[page] < dmg.lo[page])
+      dmg.lo[page] = from.lo[page];
+    if (from.hi[page] > dmg.hi[page])
+      dmg.hi[page] = from.hi[page];
+  }
+}
+
+// Send the commands that were set while the flush thread was running
+void ArduiPi_OLED::sendPendingCommands(void)
+{
+  uint8_t cmds = pending_cmds.exchange(0);
+  if (cmds & CMD_INVERT)
+    sendCommand(SSD_Inverse_Display);
+  if (cmds & CMD_NORMAL)
+    sendCommand(oled_type == OLED_SEEED_I2C_96x96 ? SSD1327_Normal_Display
+                                                  : SSD1306_Normal_Display);
+  if (cmds & CMD_RESET_OFFSET)
+    sendCommand(SSD1306_Set_Display_Offset, 0x00);
+}
+
+void *ArduiPi_OLED::flush_loop(void *data)
+{
+  ArduiPi_OLED *oled = (ArduiPi_OLED *)data;
+  while (true) {
+    sem_wait(&oled->flush_sem);
+    oled->sendPendingCommands();
+
+    // Take the latest frame, if there is a new one, and leave the buffer
+    // of the last sent frame for display() to reuse
+    if (oled->frame_ready & FRAME_FRESH) {
+      oled->frame_front =
+          oled->frame_ready.exchange(oled->frame_front) & FRAME_IDX;
+      oled->transmit(oled->pframes + oled->frame_front * oled->oled_buff_size,
+                     oled->frame_damage[oled->frame_front],
+                     oled->frame_hw_scroll[oled->frame_front]);
     }
+
+    // A frame handed over before stopping will have been sent above
+    if (oled->flush_quit)
+      break;
   }
-  // I2C
-  else {
-    char buff[17];
-    uint8_t x;
+  return NULL;
+}
+
+boolean ArduiPi_OLED::startFlushThread(void)
+{
+  if (flush_running)
+    return true;
+
+  pframes = (uint8_t *)malloc(3 * oled_buff_size);
+  if (!pframes)
+    return false;
+
+  frame_back = 0;
+  frame_front = 1;
+  frame_ready = 2;
+  clearDamage(damage_carry);
+  pending_cmds = 0;
+  flush_quit = false;
+  if (sem_init(&flush_sem, 0, 0) != 0) {
+    free(pframes);
+    pframes = NULL;
+    return false;
+  }
+
+  if (pthread_create(&flush_thread, NULL, flush_loop, (void *)this)) {
+    sem_destroy(&flush_sem);
+    free(pframes);
+    pframes = NULL;
+    return false;
+  }
+
+  flush_running = true;
+  return true;
+}
 
-    // Setup D/C to switch to data mode
-    buff[0] = SSD_Data_Mode;
+void ArduiPi_OLED::stopFlushThread(void)
+{
+  if (!flush_running)
+    return;
 
-    if (oled_type == OLED_SH1106_I2C_128x64) {
-      for (uint8_t k = 0; k < 8; k++) {
-        sendCommand(0xB0 + k); // set page addressSSD_Data_Mode;
-        sendCommand(0x02);     // set lower column address
-        sendCommand(0x10);     // set higher column address
+  // The thread sends the waiting frame, if any, before finishing
+  flush_quit = true;
+  sem_post(&flush_sem);
+  pthread_join(flush_thread, NULL);
+  sem_destroy(&flush_sem);
+  flush_running = false;
 
-        for (i = 0; i < 8; i++) {
-          for (x = 1; x <= 16; x++)
-            buff[x] = *p++;
+  free(pframes);
+  pframes = NULL;
+}
 
-          fastI2Cwrite(buff, 17);
-        }
-      }
+// Send a frame to the OLED. Only the changed part of each page, compared
+// with what was sent last time, is transmitted, and only the damaged
+// columns are compared. Pages scrolling in hardware are left alone, and
+// rewritten whole when the scroll stops or restarts.
+void ArduiPi_OLED::transmit(uint8_t *frame, const Damage &dmg,
+                            const HWScroll &scroll)
+{
+  const uint8_t pages = oled_buff_size / oled_width;
+  int16_t lo[MAX_PAGES];
+  int16_t hi[MAX_PAGES];
+
+  const boolean scroll_restart =
+      scroll.on != hw_scroll_sent.on ||
+      (scroll.on && scroll.gen != hw_scroll_sent.gen);
+  int16_t skip_lo = pages, skip_hi = -1;   // pages scrolling
+  int16_t force_lo = pages, force_hi = -1; // pages to rewrite
+  if (hw_scroll_sent.on) {
+    if (scroll_restart) {
+      sendCommand(SSD_Deactivate_Scroll);
+      force_lo = hw_scroll_sent.page_start;
+      force_hi = hw_scroll_sent.page_end;
     }
     else {
-      // loop trough all OLED buffer and
-      // send a bunch of 16 data byte in one xmission
-      for (i = 0; i < oled_buff_size; i += 16) {
-        for (x = 1; x <= 16; x++)
-          buff[x] = *p++;
-
-        fastI2Cwrite(buff, 17);
-      }
+      skip_lo = hw_scroll_sent.page_start;
+      skip_hi = hw_scroll_sent.page_end;
+    }
+  }
+
+  // Find the changed column range of each page, and the bounding window
+  uint16_t changed_bytes = 0;
+  uint8_t changed_pages = 0;
+  int16_t page_lo = pages, page_hi = -1;
+  int16_t col_lo = oled_width, col_hi = -1;
+  for (uint8_t page = 0; page < pages; page++) {
+    uint8_t *p = frame + page * oled_width;
+    uint8_t *s = pshadowbuff + page * oled_width;
+    lo[page] = 0;
+    hi[page] = oled_width - 1;
+    if (page >= skip_lo && page <= skip_hi) {
+      lo[page] = oled_width;
+      continue;
+    }
+    if (shadow_valid && (page < force_lo || page > force_hi)) {
+      lo[page] = dmg.lo[page];
+      hi[page] = dmg.hi[page];
+      while (lo[page] <= hi[page] && p[lo[page]] == s[lo[page]])
+        lo[page]++;
+      if (lo[page] > hi[page]) // page unchanged
+        continue;
+      while (p[hi[page]] == s[hi[page]])
+        hi[page]--;
+    }
+
+    changed_bytes += hi[page] - lo[page] + 1;
+    changed_pages++;
+    page_lo = (page < page_lo) ? page : page_lo;
+    page_hi = page;
+    col_lo = (lo[page] < col_lo) ? lo[page] : col_lo;
+    col_hi = (hi[page] > col_hi) ? hi[page] : col_hi;
+  }
+
+  uint16_t bytes_sent = 0;
+
+  // Send one window covering all the changes if that costs less than
+  // addressing each page separately (the window commands take about
+  // 16 bytes on I2C and 6 bytes on SPI)
+  const uint16_t page_overhead = isSPI() ? 6 : 16;
+  const uint16_t col_len = col_hi - col_lo + 1;
+  const uint16_t window_bytes = (page_hi - page_lo + 1) * col_len;
+  if (changed_pages > 1 && i2c_xfer_mode == OLED_I2C_XFER_FRAME &&
+      window_bytes <= changed_bytes + (changed_pages - 1) * page_overhead &&
+      (skip_hi < page_lo || skip_lo > page_hi)) {
+    uint8_t *q = pxferbuff + 1;
+    for (int16_t page = page_lo; page <= page_hi; page++) {
+      uint8_t *p = frame + page * oled_width + col_lo;
+      memcpy(q, p, col_len);
+      memcpy(pshadowbuff + page * oled_width + col_lo, p, col_len);
+      q += col_len;
+    }
+    setWindow(page_lo, page_hi, col_lo, col_hi);
+    sendXferBuff(window_bytes);
+    bytes_sent = window_bytes;
+  }
+  else {
+    for (int16_t page = page_lo; page <= page_hi; page++) {
+      if (lo[page] > hi[page]) // page unchanged
+        continue;
+      const uint16_t len = hi[page] - lo[page] + 1;
+      uint8_t *p = frame + page * oled_width + lo[page];
+      memcpy(pxferbuff + 1, p, len);
+      memcpy(pshadowbuff + page * oled_width + lo[page], p, len);
+      setWindow(page, page, lo[page], hi[page]);
+      sendXferBuff(len);
+      bytes_sent += len;
     }
   }
+
+  if (scroll_restart && scroll.on) {
+    const uint8_t cmds[] = {SSD_Left_Horizontal_Scroll, 0x00, scroll.page_start,
+                            scroll.interval, scroll.page_end, 0x00, 0xFF,
+                            SSD_Activate_Scroll};
+    transport->sendCommands(cmds, sizeof(cmds));
+  }
+  hw_scroll_sent = scroll;
+
+  shadow_valid = true;
+  bytes_saved = oled_buff_size - bytes_sent;
+  transport->endFrame();
+}
+
+uint16_t ArduiPi_OLED::getBytesSaved(void) { return bytes_saved; }
+
+void ArduiPi_OLED::setI2CTransferMode(uint8_t mode)
+{
+  // SH1106 only has page addressing
+  if (mode == OLED_I2C_XFER_FRAME && (oled_type == OLED_SH1106_I2C_128x64 ||
+                                      oled_type == OLED_SH1106_SPI_128x64))
+    mode = OLED_I2C_XFER_PAGE;
+  i2c_xfer_mode = mode;
 }
 
 // clear everything (in the buffer)
-void ArduiPi_OLED::clearDisplay(void) { memset(poledbuff, 0, oled_buff_size); }
+void ArduiPi_OLED::clearDisplay(void)
+{
+  memset(pcanvas ? pcanvas : poledbuff, 0, oled_buff_size);
+}
@@ -30,6 +30,11 @@ All text above, and the splash screen must be included in any redistribution
 #define _ArduiPi_OLED_H
 
 #include "./Adafruit_GFX.h"
+#include "./OLED_Transport.h"
+
+#include <atomic>
+#include <pthread.h>
+#include <semaphore.h>
 
 #define BLACK 0
 #define WHITE 1
@@ -77,6 +82,11 @@ All text above, and the splash screen must be included in any redistribution
 #define Scroll_128Frames 0x02
 #define Scroll_256Frames 0x03
 
+// Data transfer methods (CHUNK is I2C only, SPI sends pages instead)
+#define OLED_I2C_XFER_CHUNK 0 /* 16 data bytes per message (original) */
+#define OLED_I2C_XFER_PAGE 1  /* one message per changed page */
+#define OLED_I2C_XFER_FRAME 2 /* one message for all changed pages */
+
 #define VERTICAL_MODE 01
 #define PAGE_MODE 01
 #define HORIZONTAL_MODE 02
@@ -139,6 +149,9 @@ All text above, and the splash screen must be included in any redistribution
 =========================================================================*/
 #define SH1106_Set_Page_Address 0xB0
 
+struct OLED_Frame;
+struct OLED_Ops;
+
 class ArduiPi_OLED : public Adafruit_GFX {
 public:
   ArduiPi_OLED();
@@ -149,6 +162,15 @@ public:
   // I2C Init
   boolean init_i2c(int8_t RST, uint8_t OLED_TYPE, int8_t i2c_addr, int i2c_bus);
 
+  // Virtual panel Init, no hardware is used (see OLED_Virtual_Transport)
+  boolean init_virtual(uint8_t OLED_TYPE, uint32_t clock_hz,
+                       const char *pbm_path = "");
+
+  // Init with any transport, which is then owned by this object
+  boolean init_transport(OLED_Transport *trans, uint8_t OLED_TYPE,
+                         int8_t i2c_addr = 0);
+  OLED_Transport *getTransport(void) { return transport; }
+
   boolean oled_is_spi_proto(uint8_t OLED_TYPE); /* to know protocol before /init */
   boolean select_oled(uint8_t OLED_TYPE, int8_t i2c_addr=0) ;
   void reset_offset();
@@ -166,6 +188,37 @@ public:
   void setBrightness(uint8_t Brightness);
   void invertDisplay(uint8_t i);
   void display();
+  uint16_t getBytesSaved(void); // data bytes not resent by last display()
+  void setI2CTransferMode(uint8_t mode); // OLED_I2C_XFER_ value
+
+  // With damage tracking on, display() only looks for changes in the
+  // areas passed to addDamage() since the last display(). Anything drawn
+  // outside them is not sent.
+  void setDamageTracking(boolean on);
+  void addDamage(int16_t x, int16_t y, int16_t w, int16_t h);
+
+  // In canvas mode drawing is done in a row by row buffer, which
+  // display() converts to the page format of the OLED. Returns false if
+  // the OLED has no page format (Seeed 96x96) or on allocation failure.
+  boolean setCanvasMode(boolean on);
+
+  // Hardware scrolling, SSD1306 and SSD1308 only. From the next
+  // display(), pages page_start to page_end scroll left, looping round
+  // the 128 columns, and are not sent while scrolling. Calling again
+  // restarts the scroll from the picture of the next display(), and
+  // stopping rewrites the pages. The rate is rounded to one of the few
+  // the OLED supports, as given by getHardwareScrollRate().
+  boolean hasHardwareScroll(void);
+  float getHardwareScrollRate(float pixels_per_sec);
+  boolean setHardwareScroll(uint8_t page_start, uint8_t page_end,
+                            float pixels_per_sec);
+  void stopHardwareScroll(void);
+
+  // Send frames from a separate thread, display() then only hands the
+  // frame over. While running, only display(), invertDisplay() and
+  // reset_offset() may be used to access the OLED.
+  boolean startFlushThread(void);
+  void stopFlushThread(void);
 
   void setSeedTextXY(unsigned char Row, unsigned char Column);
   void putSeedChar(char C);
@@ -185,23 +238,88 @@ public:
   void stopscroll(void);
 
   void drawPixel(int16_t x, int16_t y, uint16_t color);
+  void writeLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1,
+                 uint16_t color);
+  void drawColumns(int16_t x, int16_t y, const uint8_t *cols, int16_t w,
+                   uint8_t h, uint16_t color, uint16_t bg);
+  void writeFillRect(int16_t x, int16_t y, int16_t w, int16_t h,
+                     uint16_t color);
+  void writeFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color);
+  void writeFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color);
+  void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color);
+  void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color);
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
 
 private:
-  uint8_t *poledbuff; // Pointer to OLED data buffer in memory
-  int8_t _i2c_addr, dc, rst, cs;
+  uint8_t *poledbuff;   // Pointer to OLED data buffer in memory
+  uint8_t *pcanvas;     // Row by row buffer drawn in canvas mode, or NULL
+  uint8_t *pshadowbuff; // Copy of the buffer as last sent to the OLED
+  boolean shadow_valid; // Shadow buffer matches the OLED memory
+  uint16_t bytes_saved; // Data bytes skipped by the last display()
+  uint8_t *pxferbuff;   // Control byte followed by data to transfer
+  uint8_t i2c_xfer_mode;
+
+  // Changed column range of each page, empty when lo > hi
+  enum { MAX_PAGES = 48 }; // Seeed 96x96 has most "pages"
+  struct Damage {
+    int16_t lo[MAX_PAGES];
+    int16_t hi[MAX_PAGES];
+  };
+  boolean damage_tracking;
+  Damage damage;          // added since the last display()
+  Damage damage_carry;    // of published frames that may not be sent yet
+  Damage frame_damage[3]; // of each frame buffer of the flush thread
+
+  // Hardware scroll, restarted when gen changes
+  struct HWScroll {
+    boolean on;
+    uint8_t page_start;
+    uint8_t page_end;
+    uint8_t interval; // Scroll_ value
+    uint32_t gen;
+  };
+  HWScroll hw_scroll;          // for the next display()
+  HWScroll hw_scroll_sent;     // running on the OLED
+  HWScroll frame_hw_scroll[3]; // of each frame buffer of the flush thread
+
+  // Flush thread: frames are passed through three buffers, so the newest
+  // complete frame is always the next one sent
+  enum { FRAME_FRESH = 0x04, FRAME_IDX = 0x03 };
+  enum { CMD_INVERT = 0x01, CMD_NORMAL = 0x02, CMD_RESET_OFFSET = 0x04 };
+  uint8_t *pframes;               // three frame buffers
+  uint8_t frame_back;             // index of frame to fill by display()
+  uint8_t frame_front;            // index of frame being sent
+  std::atomic<uint8_t> frame_ready; // index of latest frame, FRAME_FRESH
+  std::atomic<uint8_t> pending_cmds; // CMD_ flags to send before next frame
+  std::atomic<bool> flush_quit;
+  bool flush_running;
+  pthread_t flush_thread;
+  sem_t flush_sem;
+
+  static void *flush_loop(void *data);
+  void sendPendingCommands(void);
+  void transmit(uint8_t *frame, const Damage &dmg, const HWScroll &scroll);
+  uint8_t scrollInterval(float pixels_per_sec, float *rate);
+  void clearDamage(Damage &dmg);
+  void damageAll(Damage &dmg);
+  void mergeDamage(Damage &dmg, const Damage &from);
+  OLED_Transport *transport;
+  int8_t _i2c_addr;
   int16_t oled_width, oled_height;
   int16_t oled_buff_size;
   uint8_t vcc_type;
   uint8_t oled_type;
   uint8_t grayH, grayL;
 
-  inline boolean isI2C(void);
+  const OLED_Ops *ops; // drawing functions for the buffer format
+  void selectOps(void);
+  inline OLED_Frame drawTarget(void);
+
   inline boolean isSPI(void);
-  void fastSPIwrite(uint8_t c);
-  void fastSPIwrite(char *tbuf, uint32_t len);
-  void fastI2Cwrite(uint8_t c);
-  void fastI2Cwrite(char *tbuf, uint32_t len);
-  void slowSPIwrite(uint8_t c);
+  void setWindow(uint8_t page_start, uint8_t page_end, uint8_t col_start,
+                 uint8_t col_end);
+  void sendXferBuff(uint16_t len);
+  void fillArea(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
 
   // volatile uint8_t *dcport;
   // uint8_t dcpinmask;
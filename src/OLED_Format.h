@@ -0,0 +1,291 @@
+/*********************************************************************
+Frame buffer formats of the OLED panels.
+
+The geometry and pixel layout of each format are template constants, so
+the drawing loops are compiled separately for each panel, with the
+pixel writes inlined. ArduiPi_OLED picks the drawing functions for its
+panel type once, in select_oled().
+
+BSD license, check license.txt for more information
+*********************************************************************/
+
+#ifndef _OLED_Format_H
+#define _OLED_Format_H
+
+#include "./ArduiPi_OLED.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+// Buffer to draw in, and for gray panels the high and low nibble values
+// for a lit pixel
+struct OLED_Frame {
+  uint8_t *buf;
+  uint8_t lit_hi;
+  uint8_t lit_lo;
+};
+
+// Drawing functions for one format. Areas are clipped, with w and h
+// above 0, and columns are bytes of up to 8 rows with bit 0 at the top.
+struct OLED_Ops {
+  void (*drawPixel)(const OLED_Frame &f, int16_t x, int16_t y,
+                    uint16_t color);
+  void (*writeLine)(const OLED_Frame &f, int16_t x0, int16_t y0, int16_t x1,
+                    int16_t y1, uint16_t color);
+  void (*fillArea)(const OLED_Frame &f, int16_t x, int16_t y, int16_t w,
+                   int16_t h, uint16_t color);
+  void (*drawColumns)(const OLED_Frame &f, int16_t x, int16_t y,
+                      const uint8_t *cols, int16_t w, uint8_t h,
+                      uint16_t color, uint16_t bg);
+};
+
+// 1 bit per pixel, in pages of 8 rows with a byte for each column
+// (SSD1306, SH1106)
+template <int16_t W, int16_t H> struct OLED_Paged_Format {
+  enum { WIDTH = W, HEIGHT = H };
+
+  static inline void setPixel(const OLED_Frame &f, int16_t x, int16_t y,
+                              uint16_t color)
+  {
+    uint8_t *p = f.buf + x + (y / 8) * W;
+    if (color == WHITE)
+      *p |= _BV((y % 8));
+    else
+      *p &= ~_BV((y % 8));
+  }
+
+  // The first and last pages of each column are masked, and the pages
+  // between are set whole
+  static void fillArea(const OLED_Frame &f, int16_t x, int16_t y, int16_t w,
+                       int16_t h, uint16_t color)
+  {
+    const int16_t page_first = y / 8;
+    const int16_t page_last = (y + h - 1) / 8;
+    uint8_t top_mask = 0xFF << (y & 7);
+    const uint8_t bottom_mask = 0xFF >> (7 - ((y + h - 1) & 7));
+    const uint8_t fill = (color == WHITE) ? 0xFF : 0x00;
+    uint8_t *p = f.buf + page_first * W + x;
+
+    if (page_first == page_last)
+      top_mask &= bottom_mask;
+    for (int16_t i = 0; i < w; i++)
+      p[i] = (p[i] & ~top_mask) | (fill & top_mask);
+    if (page_first == page_last)
+      return;
+
+    for (int16_t page = page_first + 1; page < page_last; page++) {
+      p += W;
+      memset(p, fill, w);
+    }
+
+    p += W;
+    for (int16_t i = 0; i < w; i++)
+      p[i] = (p[i] & ~bottom_mask) | (fill & bottom_mask);
+  }
+
+  // Column bytes are combined straight into the pages, with a shifted
+  // write to two pages when y is not a multiple of 8
+  static void drawColumns(const OLED_Frame &f, int16_t x, int16_t y,
+                          const uint8_t *cols, int16_t w, uint8_t h,
+                          uint16_t color, uint16_t bg)
+  {
+    const uint8_t rows = 0xFF >> (8 - h); // bits of each column in use
+    const boolean opaque = (bg != color);
+    const uint8_t bg_bits = (opaque && bg == WHITE) ? 0xFF : 0x00;
+    const int16_t page = (y + 8) / 8 - 1; // y > -8, so this rounds down
+    const uint8_t shift = y - page * 8;
+    const boolean top = (page >= 0);
+    const boolean bottom = (shift && page + 1 < H / 8);
+    uint8_t *p = f.buf + page * W + x;
+
+    // Whole pages drawn opaque in white are the column bytes
+    if (opaque && h == 8 && shift == 0 && color == WHITE) {
+      memcpy(p, cols, w);
+      return;
+    }
+
+    for (int16_t i = 0; i < w; i++) {
+      const uint8_t bits = cols[i] & rows;
+      // Bits to change and their new values, over two pages
+      uint16_t mask = (opaque ? rows : bits) << shift;
+      uint16_t val = (((color == WHITE) ? bits : 0) | (bg_bits & ~bits))
+                     << shift;
+      if (top)
+        p[i] = (p[i] & ~mask) | (val & mask);
+      if (bottom)
+        p[i + W] = (p[i + W] & ~(mask >> 8)) | ((val & mask) >> 8);
+    }
+  }
+};
+
+// 1 bit per pixel, row by row, with bit 0 of each byte on the left. This
+// is the canvas of a paged panel, converted to pages when displayed.
+template <int16_t W, int16_t H> struct OLED_Row_Format {
+  enum { WIDTH = W, HEIGHT = H, STRIDE = W / 8 };
+
+  static inline void setPixel(const OLED_Frame &f, int16_t x, int16_t y,
+                              uint16_t color)
+  {
+    uint8_t *p = f.buf + y * STRIDE + x / 8;
+    if (color == WHITE)
+      *p |= _BV((x % 8));
+    else
+      *p &= ~_BV((x % 8));
+  }
+
+  // Each row is masked at its first and last bytes, and set whole between
+  static void fillArea(const OLED_Frame &f, int16_t x, int16_t y, int16_t w,
+                       int16_t h, uint16_t color)
+  {
+    const int16_t byte_first = x / 8;
+    const int16_t byte_last = (x + w - 1) / 8;
+    uint8_t left_mask = 0xFF << (x & 7);
+    const uint8_t right_mask = 0xFF >> (7 - ((x + w - 1) & 7));
+    const uint8_t fill = (color == WHITE) ? 0xFF : 0x00;
+    if (byte_first == byte_last)
+      left_mask &= right_mask;
+
+    uint8_t *p = f.buf + y * STRIDE + byte_first;
+    for (int16_t j = 0; j < h; j++, p += STRIDE) {
+      p[0] = (p[0] & ~left_mask) | (fill & left_mask);
+      if (byte_first == byte_last)
+        continue;
+      memset(p + 1, fill, byte_last - byte_first - 1);
+      p[byte_last - byte_first] =
+          (p[byte_last - byte_first] & ~right_mask) | (fill & right_mask);
+    }
+  }
+
+  // The column bits of each row are gathered 8 at a time, and combined
+  // into the row with a shifted write to two bytes
+  static void drawColumns(const OLED_Frame &f, int16_t x, int16_t y,
+                          const uint8_t *cols, int16_t w, uint8_t h,
+                          uint16_t color, uint16_t bg)
+  {
+    const boolean opaque = (bg != color);
+    const uint8_t bg_bits = (opaque && bg == WHITE) ? 0xFF : 0x00;
+    for (int8_t j = 0; j < h; j++) {
+      if (y + j < 0 || y + j >= H)
+        continue;
+      uint8_t *row = f.buf + (y + j) * STRIDE;
+      for (int16_t i0 = 0; i0 < w; i0 += 8) {
+        const int16_t n = (w - i0 < 8) ? w - i0 : 8;
+        uint8_t bits = 0;
+        for (int16_t i = 0; i < n; i++)
+          bits |= ((cols[i0 + i] >> j) & 1) << i;
+
+        const uint8_t used = 0xFF >> (8 - n);
+        const uint8_t shift = (x + i0) & 7;
+        uint8_t *p = row + (x + i0) / 8;
+        // Bits to change and their new values, over two bytes
+        uint16_t mask = (opaque ? used : bits) << shift;
+        uint16_t val = (((color == WHITE) ? bits : 0) | (bg_bits & ~bits))
+                       << shift;
+        p[0] = (p[0] & ~mask) | (val & mask);
+        if (mask >> 8)
+          p[1] = (p[1] & ~(mask >> 8)) | ((val & mask) >> 8);
+      }
+    }
+  }
+};
+
+// Convert the 8 rows of a page in a row canvas to the page bytes, and
+// back. The canvas rows are width/8 bytes long. (OLED_Transpose.cpp)
+void OLED_Rows_To_Page(const uint8_t *rows, uint8_t *page, int16_t width);
+void OLED_Page_To_Rows(const uint8_t *page, uint8_t *rows, int16_t width);
+
+// 4 bit gray, a nibble for each pixel of a pair of rows (Seeed 96x96)
+struct OLED_Gray96_Format {
+  enum { WIDTH = 96, HEIGHT = 96 };
+
+  static inline void setPixel(const OLED_Frame &f, int16_t x, int16_t y,
+                              uint16_t color)
+  {
+    uint8_t *p = f.buf + (x + (y / 2) * WIDTH);
+    // Leave the other nibble untouched
+    if (((y / 2) & 1) == 1)
+      *p = (*p & 0x0F) | (color == WHITE ? f.lit_hi : 0x00);
+    else
+      *p = (*p & 0xF0) | (color == WHITE ? f.lit_lo : 0x00);
+  }
+
+  static void fillArea(const OLED_Frame &f, int16_t x, int16_t y, int16_t w,
+                       int16_t h, uint16_t color)
+  {
+    for (int16_t j = y; j < y + h; j++)
+      for (int16_t i = x; i < x + w; i++)
+        setPixel(f, i, j, color);
+  }
+
+  static void drawColumns(const OLED_Frame &f, int16_t x, int16_t y,
+                          const uint8_t *cols, int16_t w, uint8_t h,
+                          uint16_t color, uint16_t bg)
+  {
+    for (int16_t i = 0; i < w; i++) {
+      uint8_t line = cols[i];
+      for (int8_t j = 0; j < h; j++, line >>= 1) {
+        if (y + j < 0 || y + j >= HEIGHT)
+          continue;
+        if (line & 1)
+          setPixel(f, x + i, y + j, color);
+        else if (bg != color)
+          setPixel(f, x + i, y + j, bg);
+      }
+    }
+  }
+};
+
+// Drawing functions of a format, with its geometry as constants
+template <class Format> struct OLED_Draw {
+  static inline boolean inside(int16_t x, int16_t y)
+  {
+    return x >= 0 && x < Format::WIDTH && y >= 0 && y < Format::HEIGHT;
+  }
+
+  static void drawPixel(const OLED_Frame &f, int16_t x, int16_t y,
+                        uint16_t color)
+  {
+    if (inside(x, y))
+      Format::setPixel(f, x, y, color);
+  }
+
+  // Bresenham's algorithm, as Adafruit_GFX::writeLine()
+  static void writeLine(const OLED_Frame &f, int16_t x0, int16_t y0,
+                        int16_t x1, int16_t y1, uint16_t color)
+  {
+    int16_t steep = abs(y1 - y0) > abs(x1 - x0);
+    if (steep) {
+      std::swap(x0, y0);
+      std::swap(x1, y1);
+    }
+    if (x0 > x1) {
+      std::swap(x0, x1);
+      std::swap(y0, y1);
+    }
+
+    int16_t dx = x1 - x0;
+    int16_t dy = abs(y1 - y0);
+    int16_t err = dx / 2;
+    int16_t ystep = (y0 < y1) ? 1 : -1;
+    for (; x0 <= x1; x0++) {
+      if (steep)
+        drawPixel(f, y0, x0, color);
+      else
+        drawPixel(f, x0, y0, color);
+      err -= dy;
+      if (err < 0) {
+        y0 += ystep;
+        err += dx;
+      }
+    }
+  }
+
+  static const OLED_Ops ops;
+};
+
+template <class Format>
+const OLED_Ops OLED_Draw<Format>::ops = {drawPixel, writeLine,
+                                         Format::fillArea, Format::drawColumns};
+
+#endif
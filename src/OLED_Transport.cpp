@@ -0,0 +1,517 @@
+/*********************************************************************
+Byte transports between ArduiPi_OLED and the OLED controller.
+
+See OLED_Transport.h
+
+BSD license, check license.txt for more information
+*********************************************************************/
+
+#include "./OLED_Transport.h"
+#include "./ArduiPi_OLED.h"
+
+#include <algorithm>
+#include <limits.h>
+#include <time.h>
+
+static double now_secs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*=========================================================================
+    Raspberry Pi SPI
+=========================================================================*/
+
+boolean OLED_SPI_Transport::begin(void)
+{
+  // Init Raspberry PI GPIO
+  if (!bcm2835_init())
+    return false;
+
+  // Init & Configure Raspberry PI SPI
+  bcm2835_spi_begin();
+  bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);
+  bcm2835_spi_setDataMode(BCM2835_SPI_MODE0);
+  bcm2835_spi_chipSelect(cs);
+
+  // 16 MHz SPI bus, but Worked at 62 MHz also
+  bcm2835_spi_setClockDivider(BCM2835_SPI_CLOCK_DIVIDER_16);
+
+  // Set the pin that will control DC as output
+  bcm2835_gpio_fsel(dc, BCM2835_GPIO_FSEL_OUTP);
+
+  // Setup reset pin direction as output
+  bcm2835_gpio_fsel(rst, BCM2835_GPIO_FSEL_OUTP);
+
+  return true;
+}
+
+void OLED_SPI_Transport::end(void)
+{
+  // Release Raspberry SPI and I/O control
+  bcm2835_spi_end();
+  bcm2835_close();
+}
+
+void OLED_SPI_Transport::setReset(uint8_t level)
+{
+  bcm2835_gpio_write(rst, level);
+}
+
+void OLED_SPI_Transport::sendCommands(const uint8_t *cmds, uint16_t len)
+{
+  // Setup D/C line to low to switch to command mode
+  bcm2835_gpio_write(dc, LOW);
+
+  bcm2835_spi_writenb((const char *)cmds, len);
+}
+
+void OLED_SPI_Transport::sendData(uint8_t *buf, uint16_t len, boolean chunked)
+{
+  (void)chunked; // data is always streamed through the FIFO
+
+  // Setup D/C line to high to switch to data mode
+  bcm2835_gpio_write(dc, HIGH);
+
+  bcm2835_spi_writenb((const char *)buf + 1, len);
+}
+
+/*=========================================================================
+    I2C through the kernel driver
+=========================================================================*/
+
+boolean OLED_I2C_Transport::begin(void)
+{
+  // Init Raspberry PI GPIO, for the reset pin
+  if (!bcm2835_init())
+    return false;
+
+  // Init & Configure Raspberry PI I2C
+  if (bcm2835_i2c_alt_begin(bus) == 0)
+    return false;
+
+  bcm2835_i2c_alt_setSlaveAddress(addr);
+
+  // Set clock to 400 KHz
+  // does not seem to work, will check this later
+  // bcm2835_i2c_alt_set_baudrate(400000);
+
+  // Setup reset pin direction as output
+  bcm2835_gpio_fsel(rst, BCM2835_GPIO_FSEL_OUTP);
+
+  return true;
+}
+
+void OLED_I2C_Transport::end(void)
+{
+  // Release Raspberry I2C and I/O control
+  bcm2835_i2c_alt_end();
+  bcm2835_close();
+}
+
+void OLED_I2C_Transport::setReset(uint8_t level)
+{
+  bcm2835_gpio_write(rst, level);
+}
+
+void OLED_I2C_Transport::sendCommands(const uint8_t *cmds, uint16_t len)
+{
+  char buff[17];
+
+  // Clear D/C to switch to command mode
+  buff[0] = SSD_Command_Mode;
+
+  while (len) {
+    uint16_t n = (len < 16) ? len : 16;
+    memcpy(&buff[1], cmds, n);
+    bcm2835_i2c_alt_write(buff, n + 1);
+    cmds += n;
+    len -= n;
+  }
+}
+
+void OLED_I2C_Transport::sendData(uint8_t *buf, uint16_t len, boolean chunked)
+{
+  // Single message (split by the bus code if too long for the adapter)
+  if (!chunked) {
+    buf[0] = SSD_Data_Mode;
+    bcm2835_i2c_alt_write_msg((char *)buf, len + 1);
+    return;
+  }
+
+  // Original method, send a bunch of 16 data byte in one xmission
+  char buff[17];
+  uint8_t *data = buf + 1;
+
+  // Setup D/C to switch to data mode
+  buff[0] = SSD_Data_Mode;
+
+  while (len) {
+    uint16_t n = (len < 16) ? len : 16;
+    memcpy(&buff[1], data, n);
+    bcm2835_i2c_alt_write(buff, n + 1);
+    data += n;
+    len -= n;
+  }
+}
+
+/*=========================================================================
+    Virtual panel
+=========================================================================*/
+
+OLED_Virtual_Transport::OLED_Virtual_Transport(uint8_t OLED_TYPE,
+                                               boolean spi_bus,
+                                               uint32_t bus_hz,
+                                               const char *pbm)
+{
+  oled_type = OLED_TYPE;
+  spi = spi_bus;
+  clock_hz = bus_hz ? bus_hz : 1;
+  pbm_path = strdup(pbm ? pbm : "");
+
+  width = 128;
+  height = 64;
+  ram_cols = 128; // SSD1306: 128 columns of 8 pages
+  ram_rows = 8;
+  if (oled_type == OLED_ADAFRUIT_SPI_128x32 ||
+      oled_type == OLED_ADAFRUIT_I2C_128x32)
+    height = 32;
+  else if (oled_type == OLED_SH1106_I2C_128x64 ||
+           oled_type == OLED_SH1106_SPI_128x64)
+    ram_cols = 132; // SH1106: 132 columns, display starts at column 2
+  else if (oled_type == OLED_SEEED_I2C_96x96) {
+    width = 96;
+    height = 96;
+    ram_cols = 64; // SSD1327: 64 columns of 2 pixels, 128 rows
+    ram_rows = 128;
+  }
+
+  ram = (uint8_t *)calloc(ram_cols * ram_rows, 1);
+
+  frames = 0;
+  messages = 0;
+  bytes = 0;
+  bus_secs = 0;
+  frame_bus_secs = 0;
+  sleep_bus_time = false;
+  setReset(LOW);
+}
+
+OLED_Virtual_Transport::~OLED_Virtual_Transport()
+{
+  free(ram);
+  free(pbm_path);
+}
+
+boolean OLED_Virtual_Transport::begin(void) { return ram && pbm_path; }
+
+// Reset the controller state, the RAM contents are left as they are
+void OLED_Virtual_Transport::setReset(uint8_t level)
+{
+  if (level != LOW)
+    return;
+
+  col = col_start = 0;
+  col_end = ram_cols - 1;
+  row = row_start = 0;
+  row_end = ram_rows - 1;
+  // SSD1327 resets to horizontal addressing, SSD1306 to page addressing
+  addr_mode = (oled_type == OLED_SEEED_I2C_96x96) ? 0 : 2;
+  inverse = false;
+  arg_cnt = 0;
+  args_need = 0;
+  mux = 64;
+  precharge = 0x22;
+  scroll_on = false;
+}
+
+// Number of argument bytes following a command
+uint8_t OLED_Virtual_Transport::commandArgs(uint8_t c)
+{
+  if (oled_type == OLED_SEEED_I2C_96x96) {
+    switch (c) {
+    case SSD1327_Set_Column_Address:
+    case SSD1327_Set_Row_Address:
+      return 2;
+    case SSD_Right_Horizontal_Scroll:
+    case SSD_Left_Horizontal_Scroll:
+      return 7;
+    case 0xB8: // gray scale table
+      return 15;
+    case SSD_Set_ContrastLevel:
+    case SSD_Set_Segment_Remap:
+    case SSD1327_Set_Display_Start_Line:
+    case SSD1327_Set_Display_Offset:
+    case SSD_Set_Muliplex_Ratio:
+    case 0xAB: // function selection A
+    case 0xB1: // phase length
+    case SSD1327_Set_Display_Clock_Div:
+    case 0xB6: // second pre-charge period
+    case 0xBC: // pre-charge voltage
+    case 0xBE: // VCOMH
+    case 0xD5: // function selection B
+    case SSD1327_Set_Command_Lock:
+      return 1;
+    }
+    return 0;
+  }
+
+  switch (c) {
+  case SSD_Set_Column_Address:
+  case SSD_Set_Page_Address:
+  case SSD1306_SET_VERTICAL_SCROLL_AREA:
+    return 2;
+  case SSD_Right_Horizontal_Scroll:
+  case SSD_Left_Horizontal_Scroll:
+    return 6;
+  case SSD1306_VERTICAL_AND_RIGHT_HORIZONTAL_SCROLL:
+  case SSD1306_VERTICAL_AND_LEFT_HORIZONTAL_SCROLL:
+    return 5;
+  case SSD1306_Set_Memory_Mode:
+  case SSD_Set_ContrastLevel:
+  case SSD1306_Charge_Pump_Setting:
+  case SSD_Set_Muliplex_Ratio:
+  case 0xAD: // SH1106 charge pump
+  case SSD1306_Set_Display_Offset:
+  case SSD1306_Set_Display_Clock_Div:
+  case SSD1306_Set_Precharge_Period:
+  case SSD1306_Set_Com_Pins:
+  case SSD1306_Set_Vcomh_Deselect_Level:
+    return 1;
+  }
+  return 0;
+}
+
+void OLED_Virtual_Transport::command(uint8_t c)
+{
+  if (arg_cnt < args_need) {
+    args[arg_cnt++] = c;
+    if (arg_cnt == args_need)
+      runCommand();
+    return;
+  }
+
+  cmd = c;
+  arg_cnt = 0;
+  args_need = commandArgs(c);
+  if (!args_need)
+    runCommand();
+}
+
+// Only the commands that affect the RAM contents or the image shown
+void OLED_Virtual_Transport::runCommand(void)
+{
+  if (oled_type == OLED_SEEED_I2C_96x96) {
+    if (cmd == SSD1327_Set_Column_Address) {
+      col = col_start = args[0] & 0x3F;
+      col_end = args[1] & 0x3F;
+    }
+    else if (cmd == SSD1327_Set_Row_Address) {
+      row = row_start = args[0] & 0x7F;
+      row_end = args[1] & 0x7F;
+    }
+    else if (cmd == SSD_Set_Segment_Remap)
+      addr_mode = (args[0] & 0x04) ? 1 : 0;
+    else if (cmd == SSD1327_Normal_Display)
+      inverse = false;
+    else if (cmd == SSD_Inverse_Display)
+      inverse = true;
+    return;
+  }
+
+  if (cmd < 0x10) // page addressing, lower column nibble
+    col = (col & 0xF0) | (cmd & 0x0F);
+  else if (cmd < 0x20) // page addressing, higher column nibble
+    col = (col & 0x0F) | ((cmd & 0x0F) << 4);
+  else if (cmd < 0x30 && (oled_type == OLED_SH1106_I2C_128x64 ||
+                          oled_type == OLED_SH1106_SPI_128x64))
+    ; // SH1106 only has page addressing, ignore the SSD1306 window commands
+  else if (cmd == SSD1306_Set_Memory_Mode)
+    addr_mode = args[0] & 0x03;
+  else if (cmd == SSD_Set_Column_Address) {
+    col = col_start = args[0] & 0x7F;
+    col_end = args[1] & 0x7F;
+  }
+  else if (cmd == SSD_Set_Page_Address) {
+    row = row_start = args[0] & 0x07;
+    row_end = args[1] & 0x07;
+  }
+  else if ((cmd & 0xF8) == SH1106_Set_Page_Address)
+    row = cmd & 0x07;
+  else if (cmd == SSD1306_Normal_Display)
+    inverse = false;
+  else if (cmd == SSD_Inverse_Display)
+    inverse = true;
+  else if (cmd == SSD_Set_Muliplex_Ratio)
+    mux = (args[0] & 0x3F) + 1;
+  else if (cmd == SSD1306_Set_Precharge_Period)
+    precharge = args[0];
+  else if (cmd == SSD_Right_Horizontal_Scroll ||
+           cmd == SSD_Left_Horizontal_Scroll) {
+    scroll_left = (cmd == SSD_Left_Horizontal_Scroll);
+    scroll_page_start = args[1] & 0x07;
+    scroll_interval = args[2] & 0x07;
+    scroll_page_end = args[3] & 0x07;
+  }
+  else if (cmd == SSD_Activate_Scroll) {
+    advanceScroll();
+    scroll_on = true;
+    scroll_start = now_secs();
+    scroll_steps = 0;
+  }
+  else if (cmd == SSD_Deactivate_Scroll) {
+    advanceScroll();
+    scroll_on = false;
+  }
+}
+
+// Move the scrolling pages of the RAM round by the columns due since
+// the scroll was activated
+void OLED_Virtual_Transport::advanceScroll(void)
+{
+  if (!scroll_on)
+    return;
+
+  // Frames per step, for each interval value
+  const uint16_t frames[] = {5, 64, 128, 256, 3, 4, 25, 2};
+  const double frame_hz =
+      370000.0 / (((precharge & 0x0F) + (precharge >> 4) + 50) * mux);
+  const uint32_t steps = (uint32_t)((now_secs() - scroll_start) * frame_hz /
+                                    frames[scroll_interval]);
+  const int16_t shift = (steps - scroll_steps) % width;
+  scroll_steps = steps;
+  if (!shift)
+    return;
+
+  for (int16_t page = scroll_page_start; page <= scroll_page_end; page++) {
+    uint8_t *p = ram + page * ram_cols;
+    if (scroll_left)
+      std::rotate(p, p + shift, p + width);
+    else
+      std::rotate(p, p + width - shift, p + width);
+  }
+}
+
+// Write a byte at the RAM address, and advance the address
+void OLED_Virtual_Transport::writeData(uint8_t d)
+{
+  if (col < ram_cols && row < ram_rows)
+    ram[row * ram_cols + col] = d;
+
+  if (addr_mode == 1) { // vertical
+    if (++row > row_end) {
+      row = row_start;
+      if (++col > col_end)
+        col = col_start;
+    }
+  }
+  else if (addr_mode == 0) { // horizontal
+    if (++col > col_end) {
+      col = col_start;
+      if (++row > row_end)
+        row = row_start;
+    }
+  }
+  else if (++col > col_end) // page
+    col = col_start;
+}
+
+// Bus time for a message of len bytes. I2C sends 9 bits per byte,
+// including the address byte, plus start and stop conditions.
+void OLED_Virtual_Transport::addBusTime(uint32_t len)
+{
+  const uint32_t bits = spi ? 8 * len : 9 * (len + 1) + 2;
+  const double secs = (double)bits / clock_hz;
+  bus_secs += secs;
+  frame_bus_secs += secs;
+  bytes += len;
+  messages++;
+}
+
+void OLED_Virtual_Transport::sendCommands(const uint8_t *cmds, uint16_t len)
+{
+  addBusTime(spi ? len : len + 1);
+  for (uint16_t i = 0; i < len; i++)
+    command(cmds[i]);
+}
+
+void OLED_Virtual_Transport::sendData(uint8_t *buf, uint16_t len,
+                                      boolean chunked)
+{
+  if (spi || !chunked)
+    addBusTime(spi ? len : len + 1);
+  else
+    for (uint16_t n = 0; n < len; n += 16)
+      addBusTime((len - n < 16 ? len - n : 16) + 1);
+
+  advanceScroll();
+  for (uint16_t i = 0; i < len; i++)
+    writeData(buf[i + 1]);
+}
+
+void OLED_Virtual_Transport::endFrame(void)
+{
+  frames++;
+  advanceScroll();
+
+  if (*pbm_path) {
+    char name[PATH_MAX];
+    const char *num = strstr(pbm_path, "%d");
+    if (num)
+      snprintf(name, sizeof(name), "%.*s%u%s", (int)(num - pbm_path),
+               pbm_path, frames, num + 2);
+    else
+      snprintf(name, sizeof(name), "%s", pbm_path);
+    writePBM(name);
+  }
+
+  if (sleep_bus_time) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)frame_bus_secs;
+    ts.tv_nsec = (long)((frame_bus_secs - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+  }
+  frame_bus_secs = 0;
+}
+
+boolean OLED_Virtual_Transport::getPixel(int16_t x, int16_t y)
+{
+  if (x < 0 || x >= width || y < 0 || y >= height)
+    return false;
+
+  boolean on;
+  if (oled_type == OLED_SEEED_I2C_96x96) {
+    // As ArduiPi_OLED::drawPixel(), byte x of "page" y/2 is sent to row x
+    // of driver column 8 + y/2
+    uint8_t c = ram[x * ram_cols + 8 + y / 2];
+    on = (((y / 2) & 1) ? c >> 4 : c & 0x0F) != 0;
+  }
+  else {
+    int16_t c = (ram_cols == 132) ? x + 2 : x; // SH1106 column offset
+    on = (ram[(y / 8) * ram_cols + c] >> (y % 8)) & 1;
+  }
+  return on != inverse;
+}
+
+// Lit pixels are white in the image, as on the panel
+boolean OLED_Virtual_Transport::writePBM(const char *file_name)
+{
+  FILE *file = fopen(file_name, "wb");
+  if (!file)
+    return false;
+
+  fprintf(file, "P4\n%d %d\n", width, height);
+  const int16_t row_bytes = (width + 7) / 8;
+  uint8_t line[16]; // up to 128 pixels
+  for (int16_t y = 0; y < height; y++) {
+    memset(line, 0, row_bytes);
+    for (int16_t x = 0; x < width; x++)
+      if (!getPixel(x, y)) // PBM bit set is black
+        line[x / 8] |= 0x80 >> (x % 8);
+    fwrite(line, 1, row_bytes, file);
+  }
+
+  return fclose(file) == 0;
+}
@@ -0,0 +1,158 @@
+/*********************************************************************
+Byte transports between ArduiPi_OLED and the OLED controller.
+
+The hardware transports use the Raspberry Pi SPI bus (bcm2835) and the
+kernel I2C driver (/dev/i2c-N). The virtual transport needs no hardware:
+it decodes the command and data bytes into an image of the controller
+RAM, models the time the bytes would take on the bus, and can write each
+frame as a PBM file.
+
+BSD license, check license.txt for more information
+*********************************************************************/
+
+#ifndef _OLED_Transport_H
+#define _OLED_Transport_H
+
+#include "./ArduiPi_OLED_lib.h"
+
+class OLED_Transport {
+public:
+  virtual ~OLED_Transport() {}
+
+  // Set the I2C address of the OLED, before begin()
+  virtual void setI2CAddress(uint8_t i2c_addr) { (void)i2c_addr; }
+  // Set up the bus, returns false on failure
+  virtual boolean begin(void) = 0;
+  // Release the bus
+  virtual void end(void) = 0;
+  // Set the level of the OLED reset line
+  virtual void setReset(uint8_t level) = 0;
+
+  // Send command bytes
+  virtual void sendCommands(const uint8_t *cmds, uint16_t len) = 0;
+  // Send len data bytes held from buf[1], buf[0] is free for a control
+  // byte. If chunked then I2C sends the data 16 bytes per message.
+  virtual void sendData(uint8_t *buf, uint16_t len, boolean chunked) = 0;
+  // Called after the data for a frame has been sent
+  virtual void endFrame(void) {}
+
+  virtual boolean isSPI(void) = 0;
+};
+
+// Raspberry Pi SPI bus, with DC and reset GPIOs
+class OLED_SPI_Transport : public OLED_Transport {
+public:
+  OLED_SPI_Transport(int8_t DC, int8_t RST, int8_t CS)
+      : dc(DC), rst(RST), cs(CS)
+  {
+  }
+
+  boolean begin(void);
+  void end(void);
+  void setReset(uint8_t level);
+  void sendCommands(const uint8_t *cmds, uint16_t len);
+  void sendData(uint8_t *buf, uint16_t len, boolean chunked);
+  boolean isSPI(void) { return true; }
+
+private:
+  int8_t dc, rst, cs;
+};
+
+// I2C through the kernel driver, with a reset GPIO
+class OLED_I2C_Transport : public OLED_Transport {
+public:
+  OLED_I2C_Transport(int8_t RST, int i2c_bus)
+      : rst(RST), bus(i2c_bus), addr(0)
+  {
+  }
+
+  void setI2CAddress(uint8_t i2c_addr) { addr = i2c_addr; }
+  boolean begin(void);
+  void end(void);
+  void setReset(uint8_t level);
+  void sendCommands(const uint8_t *cmds, uint16_t len);
+  void sendData(uint8_t *buf, uint16_t len, boolean chunked);
+  boolean isSPI(void) { return false; }
+
+private:
+  int8_t rst;
+  int bus;
+  uint8_t addr;
+};
+
+// Virtual panel, for running and benchmarking without hardware
+class OLED_Virtual_Transport : public OLED_Transport {
+public:
+  // Model an OLED of OLED_TYPE on an SPI or I2C bus running at clock_hz.
+  // If pbm_path is not empty each frame is written to it as a PBM image,
+  // with any "%d" in the path replaced by the frame number.
+  OLED_Virtual_Transport(uint8_t OLED_TYPE, boolean spi, uint32_t clock_hz,
+                         const char *pbm_path = "");
+  ~OLED_Virtual_Transport();
+
+  boolean begin(void);
+  void end(void) {}
+  void setReset(uint8_t level);
+  void sendCommands(const uint8_t *cmds, uint16_t len);
+  void sendData(uint8_t *buf, uint16_t len, boolean chunked);
+  void endFrame(void);
+  boolean isSPI(void) { return spi; }
+
+  // Sleep at the end of each frame for the modelled bus time, so the
+  // display is updated at the rate of the modelled hardware
+  void setRealTime(boolean real_time) { sleep_bus_time = real_time; }
+
+  // Pixel of the panel, as shown at the end of the last frame
+  boolean getPixel(int16_t x, int16_t y);
+  // Write the panel image as a binary PBM, returns false on failure
+  boolean writePBM(const char *file_name);
+
+  uint32_t getFrames(void) { return frames; }
+  uint32_t getMessages(void) { return messages; }
+  uint64_t getBytes(void) { return bytes; }
+  double getBusSecs(void) { return bus_secs; }
+
+private:
+  uint8_t oled_type;
+  int16_t width, height;
+  boolean spi;
+  uint32_t clock_hz;
+  char *pbm_path;
+
+  // Controller state
+  uint8_t *ram;
+  int16_t ram_cols, ram_rows; // RAM size in bytes, as columns and pages/rows
+  int16_t col, col_start, col_end;
+  int16_t row, row_start, row_end; // pages for SSD1306 and SH1106
+  uint8_t addr_mode;               // 0 horizontal, 1 vertical, 2 page
+  boolean inverse;
+  uint8_t cmd;       // command waiting for arguments
+  uint8_t args[16];  // arguments received so far
+  uint8_t arg_cnt;   // number of arguments received
+  uint8_t args_need; // number of arguments for cmd
+
+  // Horizontal scroll of the SSD1306, run at its nominal frame rate
+  uint8_t mux, precharge; // rows and display clocks per row set
+  boolean scroll_on;
+  boolean scroll_left;
+  uint8_t scroll_page_start, scroll_page_end, scroll_interval;
+  double scroll_start;    // time the scroll was activated
+  uint32_t scroll_steps;  // columns scrolled since then
+
+  // Statistics
+  uint32_t frames;
+  uint32_t messages;
+  uint64_t bytes;
+  double bus_secs;
+  double frame_bus_secs; // bus time since the last frame
+  boolean sleep_bus_time;
+
+  uint8_t commandArgs(uint8_t c);
+  void command(uint8_t c);
+  void runCommand(void);
+  void writeData(uint8_t d);
+  void advanceScroll(void);
+  void addBusTime(uint32_t len);
+};
+
+#endif
@@ -0,0 +1,179 @@
+/*********************************************************************
+Conversion between a row canvas and the pages of an SSD1306/SH1106.
+
+A block of 8 rows by 8 columns is an 8x8 bit matrix: the canvas holds
+it as a byte for each row, the page as a byte for each column, so
+converting is a bit transpose. The bytes of a block are packed into 64
+bits, row 0 (or column 0) in the low byte, and transposed by swapping
+bits in 2x2, 4x4 and then 8x8 sub-blocks (Hacker's Delight, 7-3).
+
+Rows are converted to pages 16 blocks at a time with NEON on ARM and
+SSE2 on x86, otherwise one block at a time.
+
+BSD license, check license.txt for more information
+*********************************************************************/
+
+#include "./OLED_Format.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OLED_TRANSPOSE_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define OLED_TRANSPOSE_SSE2
+#endif
+
+static inline uint64_t transpose8x8(uint64_t x)
+{
+  uint64_t t;
+  t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+  x = x ^ t ^ (t << 28);
+  return x;
+}
+
+// Blocks from first up to end, with the canvas rows stride bytes apart
+static void rows_to_page_blocks(const uint8_t *rows, uint8_t *page,
+                                int16_t stride, int16_t first, int16_t end)
+{
+  for (int16_t b = first; b < end; b++) {
+    uint64_t x = 0;
+    for (int k = 0; k < 8; k++)
+      x |= (uint64_t)rows[k * stride + b] << (8 * k);
+    x = transpose8x8(x);
+    for (int i = 0; i < 8; i++)
+      page[8 * b + i] = x >> (8 * i);
+  }
+}
+
+#if defined(OLED_TRANSPOSE_NEON)
+
+// 16 blocks: the row bytes are interleaved so that each vector holds the
+// 8 rows of two blocks, and these are transposed as two 64 bit lanes
+static int16_t rows_to_page_simd(const uint8_t *rows, uint8_t *page,
+                                 int16_t stride)
+{
+  int16_t b = 0;
+  for (; b + 16 <= stride; b += 16) {
+    uint8x16_t r[8];
+    for (int k = 0; k < 8; k++)
+      r[k] = vld1q_u8(rows + k * stride + b);
+
+    uint16x8_t a[8];
+    for (int k = 0; k < 4; k++) {
+      uint8x16x2_t z = vzipq_u8(r[2 * k], r[2 * k + 1]);
+      a[k] = vreinterpretq_u16_u8(z.val[0]);     // blocks 0-7
+      a[k + 4] = vreinterpretq_u16_u8(z.val[1]); // blocks 8-15
+    }
+
+    uint32x4_t c[8];
+    for (int h = 0; h < 2; h++) {
+      uint16x8x2_t lo = vzipq_u16(a[4 * h], a[4 * h + 1]); // rows 0-3
+      uint16x8x2_t hi = vzipq_u16(a[4 * h + 2], a[4 * h + 3]); // rows 4-7
+      for (int q = 0; q < 2; q++) {
+        uint32x4x2_t z = vzipq_u32(vreinterpretq_u32_u16(lo.val[q]),
+                                   vreinterpretq_u32_u16(hi.val[q]));
+        c[4 * h + 2 * q] = z.val[0];
+        c[4 * h + 2 * q + 1] = z.val[1];
+      }
+    }
+
+    const uint64x2_t m7 = vdupq_n_u64(0x00AA00AA00AA00AAULL);
+    const uint64x2_t m14 = vdupq_n_u64(0x0000CCCC0000CCCCULL);
+    const uint64x2_t m28 = vdupq_n_u64(0x00000000F0F0F0F0ULL);
+    for (int j = 0; j < 8; j++) {
+      uint64x2_t x = vreinterpretq_u64_u32(c[j]);
+      uint64x2_t t;
+      t = vandq_u64(veorq_u64(x, vshrq_n_u64(x, 7)), m7);
+      x = veorq_u64(veorq_u64(x, t), vshlq_n_u64(t, 7));
+      t = vandq_u64(veorq_u64(x, vshrq_n_u64(x, 14)), m14);
+      x = veorq_u64(veorq_u64(x, t), vshlq_n_u64(t, 14));
+      t = vandq_u64(veorq_u64(x, vshrq_n_u64(x, 28)), m28);
+      x = veorq_u64(veorq_u64(x, t), vshlq_n_u64(t, 28));
+      vst1q_u8(page + 8 * b + 16 * j, vreinterpretq_u8_u64(x));
+    }
+  }
+  return b;
+}
+
+#elif defined(OLED_TRANSPOSE_SSE2)
+
+// 16 blocks: the row bytes are interleaved so that each vector holds the
+// 8 rows of two blocks, and these are transposed as two 64 bit lanes
+static int16_t rows_to_page_simd(const uint8_t *rows, uint8_t *page,
+                                 int16_t stride)
+{
+  int16_t b = 0;
+  for (; b + 16 <= stride; b += 16) {
+    __m128i r[8];
+    for (int k = 0; k < 8; k++)
+      r[k] = _mm_loadu_si128((const __m128i *)(rows + k * stride + b));
+
+    __m128i a[8];
+    for (int k = 0; k < 4; k++) {
+      a[k] = _mm_unpacklo_epi8(r[2 * k], r[2 * k + 1]);     // blocks 0-7
+      a[k + 4] = _mm_unpackhi_epi8(r[2 * k], r[2 * k + 1]); // blocks 8-15
+    }
+
+    __m128i c[8];
+    for (int h = 0; h < 2; h++) {
+      __m128i lo[2], hi[2];
+      lo[0] = _mm_unpacklo_epi16(a[4 * h], a[4 * h + 1]); // rows 0-3
+      lo[1] = _mm_unpackhi_epi16(a[4 * h], a[4 * h + 1]);
+      hi[0] = _mm_unpacklo_epi16(a[4 * h + 2], a[4 * h + 3]); // rows 4-7
+      hi[1] = _mm_unpackhi_epi16(a[4 * h + 2], a[4 * h + 3]);
+      for (int q = 0; q < 2; q++) {
+        c[4 * h + 2 * q] = _mm_unpacklo_epi32(lo[q], hi[q]);
+        c[4 * h + 2 * q + 1] = _mm_unpackhi_epi32(lo[q], hi[q]);
+      }
+    }
+
+    const __m128i m7 = _mm_set1_epi64x(0x00AA00AA00AA00AALL);
+    const __m128i m14 = _mm_set1_epi64x(0x0000CCCC0000CCCCLL);
+    const __m128i m28 = _mm_set1_epi64x(0x00000000F0F0F0F0LL);
+    for (int j = 0; j < 8; j++) {
+      __m128i x = c[j];
+      __m128i t;
+      t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 7)), m7);
+      x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 7));
+      t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 14)), m14);
+      x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 14));
+      t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 28)), m28);
+      x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 28));
+      _mm_storeu_si128((__m128i *)(page + 8 * b + 16 * j), x);
+    }
+  }
+  return b;
+}
+
+#else
+
+static int16_t rows_to_page_simd(const uint8_t *, uint8_t *, int16_t)
+{
+  return 0;
+}
+
+#endif
+
+void OLED_Rows_To_Page(const uint8_t *rows, uint8_t *page, int16_t width)
+{
+  const int16_t stride = width / 8;
+  int16_t done = rows_to_page_simd(rows, page, stride);
+  rows_to_page_blocks(rows, page, stride, done, stride);
+}
+
+void OLED_Page_To_Rows(const uint8_t *page, uint8_t *rows, int16_t width)
+{
+  const int16_t stride = width / 8;
+  for (int16_t b = 0; b < stride; b++) {
+    uint64_t x = 0;
+    for (int i = 0; i < 8; i++)
+      x |= (uint64_t)page[8 * b + i] << (8 * i);
+    x = transpose8x8(x);
+    for (int k = 0; k < 8; k++)
+      rows[k * stride + b] = x >> (8 * k);
+  }
+}
@@ -0,0 +1,149 @@
+/*
+   Copyright (c) 2026, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+// Benchmark of converting song tags to ASCII, as the status is polled.
+// Each tag set is converted repeatedly with iconv as before, by
+// to_ascii() with no cache, and by to_ascii() with its cache, and the
+// results are compared.
+//
+// Build with "make ascii_bench", run as "ascii_bench [polls]"
+
+#include "utils.h"
+
+#include <errno.h>
+#include <iconv.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+static double now_secs()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The conversion before the cache: input copied, and a new buffer and
+// output for each call, for every tag
+static string iconv_to_ascii(const string &str)
+{
+  static iconv_t conv = iconv_open("ASCII//TRANSLIT", "UTF-8");
+  vector<char> in_buf(str.begin(), str.end());
+  char *src_ptr = in_buf.data();
+  size_t src_size = str.size();
+  vector<char> buf(1024);
+  string dst;
+  while (src_size > 0) {
+    char *dst_ptr = &buf[0];
+    size_t dst_size = buf.size();
+    if (iconv(conv, &src_ptr, &src_size, &dst_ptr, &dst_size) == (size_t)-1 &&
+        errno != E2BIG) {
+      ++src_ptr;
+      --src_size;
+    }
+    dst.append(&buf[0], buf.size() - dst_size);
+  }
+  return dst;
+}
+
+struct tag_set {
+  const char *name;
+  vector<string> tags; // origin and title pairs
+};
+
+static const vector<tag_set> tag_sets = {
+    {"English",
+     {"The Beatles", "Here Comes the Sun", "Radio Paradise",
+      "Main Mix - eclectic"}},
+    {"European",
+     {"Sigur R\xc3\xb3s", "Hopp\xc3\xadpolla", "Bj\xc3\xb6rk",
+      "J\xc3\xb3ga", "Mot\xc3\xb6rhead", "Ace of Spades",
+      "Caf\xc3\xa9 del Mar", "Se\xc3\xb1or Coconut"}},
+    {"Cyrillic",
+     {"\xd0\x9a\xd0\xb8\xd0\xbd\xd0\xbe",
+      "\xd0\x93\xd1\x80\xd1\x83\xd0\xbf\xd0\xbf\xd0\xb0 "
+      "\xd0\xba\xd1\x80\xd0\xbe\xd0\xb2\xd0\xb8"}},
+    {"CJK",
+     {"\xe5\xae\x87\xe5\xa4\x9a\xe7\x94\xb0\xe3\x83\x92\xe3\x82\xab\xe3\x83"
+      "\xab",
+      "First Love", "\xe7\x8e\x8b\xe8\x8f\xb2",
+      "\xe7\xba\xa2\xe8\xb1\x86"}},
+    {"Mixed",
+     {"The Beatles", "Here Comes the Sun", "Sigur R\xc3\xb3s",
+      "Hopp\xc3\xadpolla", "\xd0\x9a\xd0\xb8\xd0\xbd\xd0\xbe",
+      "\xd0\x93\xd1\x80\xd1\x83\xd0\xbf\xd0\xbf\xd0\xb0 "
+      "\xd0\xba\xd1\x80\xd0\xbe\xd0\xb2\xd0\xb8",
+      "\xe7\x8e\x8b\xe8\x8f\xb2", "\xe7\xba\xa2\xe8\xb1\x86"}},
+};
+
+// Convert every tag of the set on each poll, returns the time per tag
+static double time_set(const tag_set &set, int polls,
+                       string (*conv)(const string &))
+{
+  size_t len = 0;
+  double start = now_secs();
+  for (int p = 0; p < polls; p++)
+    for (const auto &tag : set.tags)
+      len += conv(tag).size();
+  double secs = now_secs() - start;
+  if (len == 0)
+    printf("(no output)\n");
+  return 1e6 * secs / (polls * set.tags.size());
+}
+
+int main(int argc, char *argv[])
+{
+  int polls = (argc > 1) ? atoi(argv[1]) : 20000;
+  if (polls < 1) {
+    fprintf(stderr, "usage: ascii_bench [polls]\n");
+    return 1;
+  }
+
+  // As mpd_oled, for transliteration
+  setlocale(LC_CTYPE, "C.UTF-8");
+
+  printf("%d polls, time per tag\n", polls);
+  for (const auto &set : tag_sets) {
+    bool same = true;
+    for (const auto &tag : set.tags)
+      same = same && (to_ascii(tag) == iconv_to_ascii(tag));
+
+    double old_us = time_set(set, polls, iconv_to_ascii);
+    set_to_ascii_cache_size(0);
+    double conv_us = time_set(set, polls, to_ascii);
+    set_to_ascii_cache_size(32);
+    double cache_us = time_set(set, polls, to_ascii);
+    printf("  %-9s iconv %8.3f us, to_ascii %8.3f us, cached %8.3f us, %s\n",
+           set.name, old_us, conv_us, cache_us, same ? "match" : "DIFFER");
+  }
+
+  return 0;
+}
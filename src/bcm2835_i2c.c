@@ -12,6 +12,7 @@
 
 #include <fcntl.h>
 #include <linux/i2c-dev.h>
+#include <linux/i2c.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
@@ -27,6 +28,18 @@
 // i2c file descriptor for opeping i2c device
 static int i2c_fd = 0;
 
+// address of the current slave, needed for I2C_RDWR messages
+static uint8_t i2c_slave_addr = 0;
+
+// whether the adapter supports plain I2C_RDWR transfers
+static int i2c_use_rdwr = 0;
+
+// Longest message accepted by the adapter, the kernel limit is 8192 bytes,
+// and the shortest message that will be tried (control byte + 16 data bytes)
+#define I2C_MAX_MSG_LEN 8192
+#define I2C_MIN_MSG_LEN 17
+static uint32_t i2c_max_msg_len = I2C_MAX_MSG_LEN;
+
 int bcm2835_i2c_alt_begin(int i2c_bus)
 {
   int fd;
@@ -41,6 +54,10 @@ int bcm2835_i2c_alt_begin(int i2c_bus)
   // Set i2c descriptor
   i2c_fd = fd;
 
+  // Check the adapter can take plain I2C messages
+  unsigned long funcs = 0;
+  i2c_use_rdwr = (ioctl(fd, I2C_FUNCS, &funcs) == 0 && (funcs & I2C_FUNC_I2C));
+
   return i2c_fd;
 }
 
@@ -59,6 +76,7 @@ int bcm2835_i2c_alt_setSlaveAddress(uint8_t addr)
     return (-1);
 
   // Set I2C Device Address
+  i2c_slave_addr = addr;
   return (ioctl(i2c_fd, I2C_SLAVE, addr));
 }
 
@@ -106,6 +124,72 @@ int bcm2835_i2c_alt_write(const char *buf, uint32_t len)
   return (reason);
 }
 
+void bcm2835_i2c_alt_set_max_msg_len(uint32_t len)
+{
+  if (len > I2C_MAX_MSG_LEN)
+    len = I2C_MAX_MSG_LEN;
+  if (len < I2C_MIN_MSG_LEN)
+    len = I2C_MIN_MSG_LEN;
+  i2c_max_msg_len = len;
+}
+
+// Writes a control byte and block of data, in as few messages as possible
+int bcm2835_i2c_alt_write_msg(char *buf, uint32_t len)
+{
+  if (!i2c_fd || len < 1)
+    return (-1);
+
+  const char ctrl = buf[0];
+  char *data = buf + 1;
+  uint32_t data_len = len - 1;
+
+  while (data_len) {
+    uint32_t n = data_len;
+    if (n > i2c_max_msg_len - 1)
+      n = i2c_max_msg_len - 1;
+
+    // Put the control byte just before this part of the data
+    char *msg_buf = data - 1;
+    char saved = *msg_buf;
+    *msg_buf = ctrl;
+
+    int ret;
+    if (i2c_use_rdwr) {
+      struct i2c_msg msg;
+      msg.addr = i2c_slave_addr;
+      msg.flags = 0;
+      msg.len = n + 1;
+      msg.buf = (__u8 *)msg_buf;
+
+      struct i2c_rdwr_ioctl_data rdwr;
+      rdwr.msgs = &msg;
+      rdwr.nmsgs = 1;
+      ret = ioctl(i2c_fd, I2C_RDWR, &rdwr);
+    }
+    else
+      ret = (write(i2c_fd, msg_buf, n + 1) == (ssize_t)(n + 1)) ? 0 : -1;
+
+    *msg_buf = saved;
+
+    if (ret < 0) {
+      // Message may be too long for the adapter, retry with shorter ones
+      if ((errno == EINVAL || errno == EOPNOTSUPP || errno == EMSGSIZE) &&
+          i2c_max_msg_len > I2C_MIN_MSG_LEN && n + 1 > I2C_MIN_MSG_LEN) {
+        bcm2835_i2c_alt_set_max_msg_len((n + 1) / 2);
+        continue;
+      }
+      /* ERROR HANDLING: i2c transaction failed */
+      fprintf(stderr, "Failed to write to the i2c bus.\n");
+      return (-1);
+    }
+
+    data += n;
+    data_len -= n;
+  }
+
+  return 0;
+}
+
 // Read an number of bytes from I2C
 // to do
 uint8_t bcm2835_i2c_alt_read(char *buf, uint32_t len)
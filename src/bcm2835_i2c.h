@@ -47,6 +47,22 @@ void bcm2835_i2c_alt_set_baudrate(uint32_t baudrate);
 /// send. \return i2c smbus command return code
 int bcm2835_i2c_alt_write(const char *buf, uint32_t len);
 
+/// Transfers a block of bytes to the currently selected I2C slave,
+/// as a single I2C_RDWR message where possible.
+/// The first byte is a control byte. If the adapter rejects a message as
+/// too long then the block is split and the control byte is repeated at the
+/// start of each part, the maximum length is then remembered for later calls.
+/// \param[in] buf Buffer of bytes to send, this is modified during the call
+/// but restored before returning.
+/// \param[in] len Number of bytes in the buf buffer, including the control
+/// byte. \return 0 on success, otherwise -1
+int bcm2835_i2c_alt_write_msg(char *buf, uint32_t len);
+
+/// Sets the maximum length of a single message sent by
+/// bcm2835_i2c_alt_write_msg(), for adapters that cap the message length.
+/// \param[in] len Maximum message length in bytes, including control byte.
+void bcm2835_i2c_alt_set_max_msg_len(uint32_t len);
+
 /// Transfers any number of bytes from the currently selected I2C slave.
 /// (as previously set by \sa bcm2835_i2c_alt_setSlaveAddress)
 /// \param[in] buf Buffer of bytes to receive.
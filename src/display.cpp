@@ -25,6 +25,7 @@
 #include "display.h"
 
 #include <algorithm>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -38,6 +39,74 @@ void print(ArduiPi_OLED &display, const char *str)
     display.write((uint8_t)str[i]);
 }
 
+namespace {
+// Columns of a spectrum bar at each of the 256 levels, as the page bytes
+// of the whole graph height, so that drawing a bar is copying a column
+class spect_tables {
+public:
+  spect_tables() : height(0), mirrored(false), pages(0) {}
+  void init(int graph_height, bool mirror);
+  bool made_for(int graph_height, bool mirror) const
+  {
+    return height == graph_height && mirrored == mirror;
+  }
+  int num_pages() const { return pages; }
+  // The whole bar, with the axis
+  const uint8_t *full(int level) const { return &fulls[level * pages]; }
+  // The top of the bar (and bottom if mirrored), with the axis
+  const uint8_t *cap(int level) const { return &caps[level * pages]; }
+  // The axis alone, for the gaps between bars
+  const uint8_t *axis() const { return &axis_col[0]; }
+
+private:
+  int height;
+  bool mirrored; // bars grow both ways from the middle, with no axis
+  int pages;
+  vector<uint8_t> fulls;
+  vector<uint8_t> caps;
+  vector<uint8_t> axis_col;
+};
+
+void spect_tables::init(int graph_height, bool mirror)
+{
+  height = graph_height;
+  mirrored = mirror;
+  pages = (height + 7) / 8;
+  fulls.assign(256 * pages, 0);
+  caps.assign(256 * pages, 0);
+  axis_col.assign(pages, 0);
+
+  auto set_row = [this](uint8_t *col, int row) {
+    if (row >= 0 && row < height)
+      col[row / 8] |= 1 << (row % 8);
+  };
+
+  if (!mirrored)
+    set_row(&axis_col[0], height - 1);
+  const int bar_height_max = height - 1;
+  for (int level = 0; level < 256; level++) {
+    uint8_t *full_col = &fulls[level * pages];
+    uint8_t *cap_col = &caps[level * pages];
+    std::copy(axis_col.begin(), axis_col.end(), full_col);
+    std::copy(axis_col.begin(), axis_col.end(), cap_col);
+    // map level to graph height, rounded
+    const int val = (2 * bar_height_max * level + 255) / 510;
+    if (val == 0)
+      continue;
+
+    // Bars stand on the axis with a one row gap, mirrored bars are centred
+    const int first =
+        mirrored ? bar_height_max / 2 - val / 2 : height - val - 2;
+    const int last = first + val - 1;
+    for (int row = first; row <= last; row++)
+      set_row(full_col, row);
+    set_row(cap_col, std::max(first, 0));
+    if (mirrored)
+      set_row(cap_col, last);
+  }
+}
+} // namespace
+
 int draw_spectrum(ArduiPi_OLED &display, int x_start, int y_start, int width,
                   int height, const spect_graph &spect)
 {
@@ -52,23 +121,98 @@ int draw_spectrum(ArduiPi_OLED &display, int x_start, int y_start, int width,
   if (bar_width < 1 || bar_height_max < 1) // bars too small to draw
     return -1;
 
-  // Draw spectrum graph axes
-  display.drawFastHLine(x_start, height - 1 - y_start, graph_width, WHITE);
+  // Tables are remade when the graph height or geometry style changes
+  static spect_tables tables;
+  const bool mirrored = (spect.style == 'm');
+  if (!tables.made_for(height, mirrored))
+    tables.init(height, mirrored);
+
+  // Each page of the graph is assembled from the table columns, with the
+  // inside of an outline bar showing only the cap, and drawn opaque in one
+  // call, which for a whole page is a copy
+  static vector<uint8_t> cols;
+  const int pages = tables.num_pages();
+  cols.resize(pages * graph_width);
   for (int i = 0; i < num_bars; i++) {
-    // map vals range to graph ht
-    int val = bar_height_max * spect.heights[i] / 255.0 + 0.5;
-    int x = x_start + i * (bar_width + gap);
-    // int y = y_start+2;
-    if (val)
-      display.fillRect(x, y_start + height - val - 2, bar_width, val, WHITE);
+    const uint8_t *full = tables.full(spect.heights[i]);
+    const uint8_t *cap = tables.cap(spect.heights[i]);
+    const uint8_t *peak = tables.cap(spect.peaks[i]);
+    uint8_t *bar = &cols[i * (bar_width + gap)];
+    for (int page = 0; page < pages; page++, bar += graph_width) {
+      uint8_t edge = full[page];
+      uint8_t inside = edge;
+      if (spect.style == 'p')
+        edge = inside = edge | peak[page];
+      else if (spect.style == 'o')
+        inside = cap[page];
+      bar[0] = edge;
+      for (int j = 1; j < bar_width - 1; j++)
+        bar[j] = inside;
+      bar[bar_width - 1] = edge;
+      if (i < num_bars - 1)
+        for (int j = bar_width; j < bar_width + gap; j++)
+          bar[j] = tables.axis()[page];
+    }
   }
+  for (int page = 0; page < pages; page++)
+    display.drawColumns(x_start, y_start + 8 * page, &cols[page * graph_width],
+                        graph_width, std::min(8, height - 8 * page), WHITE,
+                        BLACK);
   return 0;
 }
 
+namespace {
+// Clock characters scaled up to a text size, held as sz pages of column
+// bytes so that each is drawn with one drawColumns() call per page
+class scaled_chars {
+public:
+  scaled_chars(const ArduiPi_OLED &display, int sz);
+  // Draw in WHITE with a transparent background, false if c is not held
+  bool draw(ArduiPi_OLED &display, int x, int y, char c) const;
+
+private:
+  static const char *chars;
+  int sz;
+  vector<uint8_t> pages;
+};
+
+const char *scaled_chars::chars = "0123456789: ";
+
+scaled_chars::scaled_chars(const ArduiPi_OLED &display, int sz) : sz(sz)
+{
+  const int W = 6 * sz;
+  const int num_chars = strlen(chars);
+  pages.assign(num_chars * sz * W, 0);
+  for (int i = 0; i < num_chars; i++) {
+    const uint8_t *glyph = display.getGlyphColumns(chars[i]);
+    uint8_t *char_pages = &pages[i * sz * W];
+    for (int x = 0; x < W; x++)
+      for (int y = 0; y < 8 * sz; y++)
+        if ((glyph[x / sz] >> (y / sz)) & 1)
+          char_pages[(y / 8) * W + x] |= 1 << (y % 8);
+  }
+}
+
+bool scaled_chars::draw(ArduiPi_OLED &display, int x, int y, char c) const
+{
+  const char *pos = strchr(chars, c);
+  if (c == '\0' || pos == nullptr)
+    return false;
+  const int W = 6 * sz;
+  const uint8_t *char_pages = &pages[(pos - chars) * sz * W];
+  for (int page = 0; page < sz; page++)
+    display.drawColumns(x, y + 8 * page, char_pages + page * W, W, 8, WHITE,
+                        WHITE);
+  return true;
+}
+} // namespace
+
 // Draw time, according to clock_format: 0-3
 void draw_time(ArduiPi_OLED &display, int start_x, int start_y, int sz,
                int clock_format)
 {
+  // Characters are scaled on the first use of each text size
+  static std::map<int, scaled_chars> clock_chars;
   display.setTextColor(WHITE);
 
   time_t t = time(0);
@@ -76,14 +220,19 @@ void draw_time(ArduiPi_OLED &display, int start_x, int start_y, int sz,
   const size_t STR_SZ = 32;
   char str[STR_SZ];
   const char *fmts[] = {"%H:%M", "%k:%M", "%I:%M", "%l:%M"};
-  if (clock_format >= 0 || clock_format < (int)sizeof(fmts))
+  if (clock_format >= 0 && clock_format < (int)(sizeof(fmts) / sizeof(fmts[0])))
     strftime(str, STR_SZ, fmts[clock_format], now);
   else
     str[0] = '\0';
 
-  display.setCursor(start_x, start_y);
-  display.setTextSize(sz);
-  print(display, str);
+  auto it = clock_chars.find(sz);
+  if (it == clock_chars.end())
+    it = clock_chars.emplace(sz, scaled_chars(display, sz)).first;
+  for (int i = 0; str[i]; i++) {
+    int x = start_x + 6 * sz * i;
+    if (!it->second.draw(display, x, start_y, str[i]))
+      display.drawChar(x, start_y, str[i], WHITE, WHITE, sz);
+  }
   int W = 6; // width of a character box
   int N = 5; // number of character
   if (clock_format > 1 && now->tm_hour >= 12)
@@ -111,32 +260,107 @@ void draw_date(ArduiPi_OLED &display, int start_x, int start_y, int sz,
 }
 
 // Draw a connection indicator, 12x8
+// Connection icons as column bytes, bit 0 at the top. The WiFi icon has
+// four bars, 3 columns apart, and is drawn up to the last bar to show.
+static const uint8_t wifi_sprite[] = {0x00, 0x40, 0x40, 0x00, 0x70, 0x70,
+                                      0x00, 0x7C, 0x7C, 0x00, 0x7F, 0x7F};
+static const uint8_t eth_sprite[] = {0x00, 0x34, 0x36, 0x37, 0x36, 0x36,
+                                     0x36, 0x36, 0x76, 0x36, 0x16};
+
 void draw_connection(ArduiPi_OLED &display, int x_start, int y_start,
                      const connection_info &conn)
 {
-  const int char_ht = 8;
   if (conn.get_type() == connection_info::TYPE_WIFI) {
-    for (int i = 0; i < 4; i++) {
-      int ht = 2 * i + 1;
-      int x_off = 3 * i + 1;
-      if (conn.get_link() > 20 * i)
-        display.fillRect(x_start + x_off, y_start + char_ht - (1 + ht), 2, ht,
-                         WHITE);
-      else
-        break;
-    }
+    int bars = 0;
+    while (bars < 4 && conn.get_link() > 20 * bars)
+      bars++;
+    display.drawColumns(x_start, y_start, wifi_sprite, 3 * bars, 8, WHITE,
+                        WHITE);
   }
   else if (conn.get_type() == connection_info::TYPE_ETH) {
-    int w = 10;
-    display.drawPixel(x_start + 3, y_start, WHITE);
-    display.drawFastHLine(x_start + 1 + 1, y_start + 1, w - 1, WHITE);
-    display.drawFastHLine(x_start + 1, y_start + 2, w, WHITE);
-    display.drawFastHLine(x_start + 1, y_start + 4, w, WHITE);
-    display.drawFastHLine(x_start + 1, y_start + 5, w - 1, WHITE);
-    display.drawPixel(x_start + 1 + w - 3, y_start + 6, WHITE);
+    display.drawColumns(x_start, y_start, eth_sprite, sizeof(eth_sprite), 8,
+                        WHITE, WHITE);
   }
 }
 
+namespace {
+// Target for rendering a sprite, with the pixels set in pages of column
+// bytes as taken by drawColumns()
+class sprite_canvas : public Adafruit_GFX {
+public:
+  sprite_canvas(int w, int h, std::vector<uint8_t> &cols)
+      : Adafruit_GFX(w, h), cols(cols)
+  {
+    cols.assign(((h + 7) / 8) * w, 0);
+  }
+  void drawPixel(int16_t x, int16_t y, uint16_t color)
+  {
+    if (x < 0 || x >= _width || y < 0 || y >= _height)
+      return;
+    uint8_t *p = &cols[(y / 8) * _width + x];
+    if (color == WHITE)
+      *p |= 1 << (y % 8);
+    else
+      *p &= ~(1 << (y % 8));
+  }
+
+private:
+  std::vector<uint8_t> &cols;
+};
+
+// Key of a widget sprite: widget, size and the state it shows
+uint64_t sprite_key(char widget, int w, int h, unsigned int state)
+{
+  return ((uint64_t)widget << 56) | ((uint64_t)(w & 0xFF) << 48) |
+         ((uint64_t)(h & 0xFF) << 40) | state;
+}
+} // namespace
+
+void sprite_cache::draw(ArduiPi_OLED &display, int x, int y, int w, int h,
+                        uint64_t key, const render_fn &render)
+{
+  if (max_sprites == 0 || w <= 0 || h <= 0) {
+    render(display, x, y);
+    return;
+  }
+
+  auto it = sprites.find(key);
+  if (it == sprites.end()) {
+    if (sprites.size() >= max_sprites) {
+      sprites.erase(lru.back());
+      lru.pop_back();
+    }
+    it = sprites.insert(std::make_pair(key, sprite())).first;
+    sprite_canvas canvas(w, h, it->second.cols);
+    render(canvas, 0, 0);
+    lru.push_front(key);
+  }
+  else
+    lru.splice(lru.begin(), lru, it->second.lru_pos);
+  it->second.lru_pos = lru.begin();
+
+  // Drawn transparent, like the widget drawn directly
+  const uint8_t *cols = &it->second.cols[0];
+  for (int page = 0; page < (h + 7) / 8; page++)
+    display.drawColumns(x, y + 8 * page, cols + page * w, w,
+                        std::min(8, h - 8 * page), WHITE, WHITE);
+}
+
+void sprite_cache::set_max_sprites(size_t max)
+{
+  max_sprites = max;
+  while (sprites.size() > max_sprites) {
+    sprites.erase(lru.back());
+    lru.pop_back();
+  }
+}
+
+sprite_cache &widget_sprites()
+{
+  static sprite_cache cache;
+  return cache;
+}
+
 // Draw a slider
 void draw_slider(ArduiPi_OLED &display, int x_start, int y_start, int width,
                  int height, float percent)
@@ -154,71 +378,110 @@ void draw_solid_slider(ArduiPi_OLED &display, int x_start, int y_start,
   display.fillRect(x_start, y_start, bar_width, height, WHITE);
 }
 
-// Draw triangle slider
+// Draw triangle slider, from a sprite for each size of the triangle
 void draw_triangle_slider(ArduiPi_OLED &display, int x_start, int y_start,
                           int width, int height, float percent)
 {
+  // Corners as drawn at x_start, y_start, relative to there
   const float frac = percent / 100;
-  display.fillTriangle(x_start, y_start + height - 1,
-                       x_start + (width - 1) * frac, y_start + height - 1,
-                       x_start + (width - 1) * frac,
-                       y_start + (height - 1) * (1 - frac), WHITE);
+  const int right = (int16_t)(x_start + (width - 1) * frac) - x_start;
+  const int top = (int16_t)(y_start + (height - 1) * (1 - frac)) - y_start;
+  widget_sprites().draw(
+      display, x_start, y_start, width, height,
+      sprite_key('t', width, height, ((right & 0xFF) << 8) | (top & 0xFF)),
+      [=](Adafruit_GFX &gfx, int x, int y) {
+        gfx.fillTriangle(x, y + height - 1, x + right, y + height - 1,
+                         x + right, y + top, WHITE);
+      });
 }
 
 // Draw text
 void draw_text(ArduiPi_OLED &display, int x_start, int y_start, int max_len,
-               string str)
+               const string &str)
 {
-  if ((int)str.size() > max_len)
-    str.resize(max_len);
-
   display.setTextColor(WHITE);
   display.setCursor(x_start, y_start);
   display.setTextSize(1);
-  print(display, str.c_str());
+  const int len = std::min((int)str.size(), max_len);
+  for (int i = 0; i < len; i++)
+    display.write((uint8_t)str[i]);
+}
+
+void text_strip::set_text(const ArduiPi_OLED &display, const string &str)
+{
+  if (str == text && !cols.empty())
+    return;
+  text = str;
+  // Each character is 6 columns, and the gap is blank columns
+  cols.assign((str.size() + gap_chars) * 6, 0);
+  for (size_t i = 0; i < str.size(); i++) {
+    const uint8_t *glyph = display.getGlyphColumns(str[i]);
+    std::copy(glyph, glyph + 6, &cols[i * 6]);
+  }
+}
+
+void text_strip::draw(ArduiPi_OLED &display, int x, int y, int offset,
+                      int w) const
+{
+  const int first = std::min(w, width() - offset);
+  display.drawColumns(x, y, &cols[offset], first, 8, WHITE, WHITE);
+  if (first < w)
+    display.drawColumns(x + first, y, &cols[0], w - first, 8, WHITE, WHITE);
 }
 
 // Draw text
 void draw_text_scroll(ArduiPi_OLED &display, int x_start, int y_start,
-                      int max_len, string str, vector<double> scroll,
-                      double secs)
+                      int max_len, const string &str,
+                      const vector<double> &scroll, double secs,
+                      text_strip &strip)
 {
   if ((int)str.size() <= max_len) {
     draw_text(display, x_start, y_start, max_len, str);
     return;
   }
+
+  // The text is rendered into the strip only when it changes, and each
+  // frame draws a window of the strip, wrapping around into the text again
+  strip.set_text(display, str);
+  int pix_shift = text_scroll_offset(str, max_len, scroll, secs);
+  strip.draw(display, x_start, y_start, pix_shift, max_len * 6);
+}
+
+int text_scroll_offset(const string &str, int max_len,
+                       const vector<double> &scroll, double secs)
+{
+  if ((int)str.size() <= max_len)
+    return 0;
   const double pixels_per_sec = scroll[0];
   const double scroll_after_secs = scroll[1];
-
-  int size = 1;
-  int W = 6 * size;
-  str += "     ";
+  const int loop_width = (str.size() + text_strip::gap_chars) * 6;
   double elapsed = secs - scroll_after_secs;
-  int pix_shift = (elapsed < 0)
-                      ? 0.0
-                      : int(elapsed * pixels_per_sec + 0.5) % (str.size() * W);
-  int pix_offset = pix_shift % W;
-  int char_pix_offset = (W - pix_offset) % W;
-  int char_shift = pix_shift / W + (char_pix_offset > 0);
-  std::rotate(str.begin(), str.begin() + char_shift, str.end());
-  // fprintf(stderr, "%c : %4d : %4d : %4d : %4d\n", str[0], pix_shift,
-  // pix_offset, char_pix_offset, char_shift);
+  return (elapsed < 0) ? 0 : int(elapsed * pixels_per_sec + 0.5) % loop_width;
+}
 
-  display.setTextColor(WHITE);
-  display.setTextSize(size);
-  display.setCursor(x_start, y_start);
-  // Draw first partial character
-  if (char_pix_offset > 0)
-    display.drawCharPart(x_start, y_start, W - char_pix_offset, W,
-                         str[str.size() - 1], WHITE, BLACK, 1);
-  str.resize(max_len + 1);
-  display.setCursor(x_start + char_pix_offset, y_start);
-  // Draw intermediate characters
-  print(display, str.substr(0, max_len - 1).c_str());
-  // Draw last partial character
-  display.drawCharPart(x_start + (max_len - 1) * W + char_pix_offset, y_start,
-                       0, pix_offset ? pix_offset : W, str[max_len - 1], WHITE,
-                       BLACK, 1);
+int text_hw_scroll_offset(const string &str, int max_len,
+                          const vector<double> &scroll, double secs)
+{
+  if ((int)str.size() <= max_len || secs < scroll[1])
+    return -1;
+  const int offset = text_scroll_offset(str, max_len, scroll, secs);
+  return offset - offset % hw_scroll_step;
+}
+
+void draw_text_hw_scroll(ArduiPi_OLED &display, int y_start, int max_len,
+                         const string &str, int offset, text_strip &strip)
+{
+  if (offset < 0) {
+    draw_text(display, 0, y_start, max_len, str);
+    return;
+  }
+
+  // Column x shows the same part of the strip as it would when scrolling
+  // in software, and the text moves into the margin as the OLED scrolls
+  strip.set_text(display, str);
+  strip.draw(display, hw_scroll_margin, y_start,
+             (offset + hw_scroll_margin) % strip.width(),
+             display.width() - hw_scroll_margin);
 }
 
 static void set_rotation(ArduiPi_OLED &display, bool upside_down)
@@ -233,6 +496,18 @@ static void set_rotation(ArduiPi_OLED &display, bool upside_down)
   }
 }
 
+static void setup_display(ArduiPi_OLED &display, bool rotate180)
+{
+  display.begin();
+
+  set_rotation(display, rotate180);
+  display.setTextWrap(false);
+
+  // init done
+  display.clearDisplay(); // clears the screen  buffer
+  display.display();      // display it (clear display)
+}
+
 bool init_display(ArduiPi_OLED &display, int oled, unsigned char i2c_addr,
                   int i2c_bus, int reset_gpio, int spi_dc_gpio, int spi_cs,
                   bool rotate180)
@@ -249,14 +524,22 @@ bool init_display(ArduiPi_OLED &display, int oled, unsigned char i2c_addr,
       return false;
   }
 
-  display.begin();
+  setup_display(display, rotate180);
+  return true;
+}
 
-  set_rotation(display, rotate180);
-  display.setTextWrap(false);
+bool init_virtual_display(ArduiPi_OLED &display, int oled,
+                          unsigned int clock_hz, const string &pbm_path,
+                          bool rotate180)
+{
+  if (!display.init_virtual(oled, clock_hz, pbm_path.c_str()))
+    return false;
 
-  // init done
-  display.clearDisplay(); // clears the screen  buffer
-  display.display();      // display it (clear display)
+  // Update at the rate the modelled bus would allow
+  OLED_Virtual_Transport *trans =
+      static_cast<OLED_Virtual_Transport *>(display.getTransport());
+  trans->setRealTime(true);
 
+  setup_display(display, rotate180);
   return true;
 }
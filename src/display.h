@@ -30,6 +30,9 @@
 
 #include "display_info.h"
 
+#include <functional>
+#include <list>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -50,6 +53,36 @@ void draw_date(ArduiPi_OLED &display, int start_x, int start_y, int sz,
 void draw_connection(ArduiPi_OLED &display, int x_start, int y_start,
                      const connection_info &conn);
 
+// Widgets that take a limited number of states, like the triangle slider,
+// are rendered once for each state as a sprite of column bytes and then
+// drawn from the sprite. The least recently used sprites are dropped to hold no
+// more than max_sprites.
+class sprite_cache {
+public:
+  // Draw a sprite on gfx at x, y
+  typedef std::function<void(Adafruit_GFX &gfx, int x, int y)> render_fn;
+
+  sprite_cache(size_t max_sprites = 256) : max_sprites(max_sprites) {}
+  // Draw the w by h sprite held for key, rendering it first if it is not
+  // held. If max_sprites is 0 then it is rendered on the display instead.
+  void draw(ArduiPi_OLED &display, int x, int y, int w, int h, uint64_t key,
+            const render_fn &render);
+  void set_max_sprites(size_t max);
+  size_t size() const { return sprites.size(); }
+
+private:
+  struct sprite {
+    std::vector<uint8_t> cols; // pages of w column bytes
+    std::list<uint64_t>::iterator lru_pos;
+  };
+  size_t max_sprites;
+  std::map<uint64_t, sprite> sprites;
+  std::list<uint64_t> lru; // keys, most recently drawn first
+};
+
+// Sprite cache of the widget drawing functions
+sprite_cache &widget_sprites();
+
 // Draw a slider
 void draw_slider(ArduiPi_OLED &display, int x_start, int y_start, int width,
                  int height, float percent);
@@ -64,15 +97,62 @@ void draw_triangle_slider(ArduiPi_OLED &display, int x_start, int y_start,
 
 // Draw text
 void draw_text(ArduiPi_OLED &display, int x_start, int y_start, int max_len,
-               std::string str);
-
-// Draw text and scroll in box
+               const std::string &str);
+
+// Text rendered as a strip of column bytes, followed by a gap, to be
+// drawn as a scrolling window of the strip
+class text_strip {
+public:
+  // Render str, unless it is the text already held
+  void set_text(const ArduiPi_OLED &display, const std::string &str);
+  // Draw w columns from column offset, continuing from the strip start
+  void draw(ArduiPi_OLED &display, int x, int y, int offset, int w) const;
+  // Width in pixels, including the gap
+  int width() const { return cols.size(); }
+
+  static const int gap_chars = 5; // spaces between the end and the start
+
+private:
+  std::string text;
+  std::vector<uint8_t> cols;
+};
+
+// Draw text and scroll in box, rendering it into strip when it changes
 void draw_text_scroll(ArduiPi_OLED &display, int x_start, int y_start,
-                      int max_len, std::string str, std::vector<double> scroll,
-                      double secs = 0.0);
+                      int max_len, const std::string &str,
+                      const std::vector<double> &scroll, double secs,
+                      text_strip &strip);
+
+// Pixel offset of scrolling text, after secs, 0 if it is not scrolled
+int text_scroll_offset(const std::string &str, int max_len,
+                       const std::vector<double> &scroll, double secs);
+
+// Text scrolled by the OLED hardware is drawn across the whole width, as
+// a blank margin followed by a window of the strip. The OLED moves it
+// left, looping round, and it is redrawn further on in the strip every
+// hw_scroll_step pixels, before the margin has been used up.
+const int hw_scroll_margin = 8;
+const int hw_scroll_step = 6;
+
+// Pixel offset of text scrolled by the OLED hardware when it was last
+// redrawn, after secs, or -1 if it is not scrolled
+int text_hw_scroll_offset(const std::string &str, int max_len,
+                          const std::vector<double> &scroll, double secs);
+
+// Draw text to be scrolled by the OLED hardware, from offset, or as plain
+// text if offset is -1
+void draw_text_hw_scroll(ArduiPi_OLED &display, int y_start, int max_len,
+                         const std::string &str, int offset,
+                         text_strip &strip);
 
 bool init_display(ArduiPi_OLED &display, int oled, unsigned char i2c_addr,
                   int i2c_bus, int reset_gpio, int spi_dc_gpio, int spi_cs,
                   bool rotate180 = false);
 
+// Initialise a virtual OLED, with a modelled bus running at clock_hz, and
+// optionally writing each frame as a PBM image (see OLED_Virtual_Transport)
+bool init_virtual_display(ArduiPi_OLED &display, int oled,
+                          unsigned int clock_hz, const std::string &pbm_path,
+                          bool rotate180 = false);
+
 #endif // DISPLAY_H
@@ -26,40 +26,107 @@
 #define DISPLAY_INFO_H
 
 #include "status.h"
+#include <algorithm>
+#include <atomic>
 #include <vector>
 
 struct spect_graph {
   int gap;                            // size of gap in pixels
+  char style;                         // b bars, m mirrored, p peaks, o outline
   std::vector<unsigned char> heights; // bar heights
+  std::vector<unsigned char> peaks;   // peak heights, for the p style
+  int peak_fall;                      // peak height lost each frame
 
-  void init(int bars, int gap_sz)
+  void init(int bars, int gap_sz, char style_c = 'b', int framerate = 15)
   {
     gap = gap_sz;
+    style = style_c;
     heights.resize(bars, 0);
+    peaks.resize(bars, 0);
+    peak_fall = std::max(1, 255 * 2 / (3 * framerate)); // all in 1.5 secs
   }
+
+  // Raise the peaks to the bar heights, or let them fall, once per frame
+  void update_peaks()
+  {
+    for (size_t i = 0; i < heights.size(); i++)
+      peaks[i] = std::max((int)heights[i], peaks[i] - peak_fall);
+  }
+};
+
+// Status values published by the status thread for the render loop
+struct status_snapshot {
+  mpd_info status;
+  connection_info conn;
+  std::string kbitrate_str;
+  unsigned text_gen; // incremented when the title, origin or state change
+};
+
+// Triple buffer handing status snapshots from the status thread to the
+// render loop. Neither side blocks, a snapshot is filled in place by the
+// writer and only read after it is published, and the reader always gets
+// the latest complete snapshot.
+class status_buffer {
+private:
+  enum { FRESH = 0x04, IDX = 0x03 };
+  status_snapshot snaps[3];
+  unsigned back;               // writer's snapshot
+  unsigned front;              // reader's snapshot
+  std::atomic<unsigned> ready; // published snapshot index, and FRESH flag
+
+public:
+  status_buffer() : back(0), front(1), ready(2) {}
+  status_buffer(const status_buffer &) = delete;
+  status_buffer &operator=(const status_buffer &) = delete;
+
+  // Writer: snapshot to fill before calling publish()
+  status_snapshot &get_back() { return snaps[back]; }
+
+  // Writer: make the back snapshot the latest one
+  void publish()
+  {
+    back = ready.exchange(back | FRESH, std::memory_order_acq_rel) & IDX;
+  }
+
+  // Reader: switch to the latest snapshot, if a new one has been
+  // published. Returns true if the snapshot changed.
+  bool update()
+  {
+    if (!(ready.load(std::memory_order_relaxed) & FRESH))
+      return false;
+    front = ready.exchange(front, std::memory_order_acq_rel) & IDX;
+    return true;
+  }
+
+  // Reader: current snapshot, valid until the next call of update()
+  const status_snapshot &get_front() const { return snaps[front]; }
 };
 
 struct display_info {
   spect_graph spect;
-  mpd_info status;
+  const status_snapshot *snap; // status values, owned by the status buffer
   Counter text_change;
+  unsigned text_gen;
   std::vector<double> scroll;
+  bool hw_scroll; // title and origin are scrolled by the OLED hardware
   int clock_format;
   int date_format;
   char pause_screen;
-  connection_info conn;
-  void conn_init() { conn.init(); }
-  void update_from(const display_info &new_info);
+
+  display_info() : snap(nullptr), text_gen(0), hw_scroll(false) {}
+  const mpd_info &status() const { return snap->status; }
+  const connection_info &conn() const { return snap->conn; }
+  void update_from(status_buffer &status_buf);
 };
 
-inline void display_info::update_from(const display_info &new_info)
+inline void display_info::update_from(status_buffer &status_buf)
 {
-  bool changed = (status.get_title() != new_info.status.get_title() ||
-                  status.get_origin() != new_info.status.get_origin() ||
-                  status.get_state() != new_info.status.get_state());
-  *this = new_info;
-  if (changed)
+  status_buf.update();
+  snap = &status_buf.get_front();
+  if (snap->text_gen != text_gen) {
+    text_gen = snap->text_gen;
     text_change.reset();
+  }
 }
 
 #endif // DISPLAY_INFO_H
@@ -31,6 +31,11 @@
  *
  * Modified by Adrian Rossiter <adrian@antiprism.com> 11/11/2019:
  *   Compile with C++. Wrap in class to remove global variables.
+ *
+ * Modified by Adrian Rossiter <adrian@antiprism.com> 2026:
+ *   get() keeps an HTTP/1.1 connection open between requests, with the
+ *   server address cached, buffered reads and connect and read timeouts.
+ *   start_get() and finish_get() split a get() around other work.
  */
 
 //static char *rcsid = "$Id: http_lib.c,v 3.5 1998/09/23 06:19:15 dl Exp $";
@@ -43,8 +48,12 @@
 /* unix */
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -124,6 +133,21 @@ int http_read_buffer(int fd,       /* file descriptor to read from */
   return n;
 }
 
+/*
+ * wait until fd is ready for events, for up to timeout_ms
+ * returns 1 if ready, 0 on timeout or error
+ */
+int http_wait(int fd, short events, int timeout_ms)
+{
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = events;
+  int r;
+  while ((r = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR)
+    ;
+  return r > 0;
+}
+
 }; // namespace
 
 HttpRequest::http_retcode  HttpRequest::set_proxy(char *proxy)
@@ -161,27 +185,18 @@ HttpRequest::http_retcode HttpRequest::http_query(
 )
 {
   int s;
-  struct hostent *hp;
-  struct sockaddr_in server;
+  const struct sockaddr_in *server;
   char header[MAXBUF];
   int hlg;
   http_retcode ret;
   int proxy = (http_proxy_server.size() && http_proxy_port != 0);
-  int port = proxy ? http_proxy_port : http_port;
 
   if (pfd)
     *pfd = -1;
 
-  /* get host info by name :*/
-  if ((hp = gethostbyname(proxy ? http_proxy_server.c_str()
-                                : (http_server.size() ? http_server.c_str()
-                                                      : SERVER_DEFAULT)))) {
-    memset((char *)&server, 0, sizeof(server));
-    memmove((char *)&server.sin_addr, hp->h_addr, hp->h_length);
-    server.sin_family = hp->h_addrtype;
-    server.sin_port = (unsigned short)htons(port);
-  } else
-    return ERRHOST;
+  /* get host info by name, if not already known :*/
+  if ((ret = resolve(&server)) < 0)
+    return ret;
 
   /* create socket */
   if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0)
@@ -189,8 +204,10 @@ HttpRequest::http_retcode HttpRequest::http_query(
   setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, 0, 0);
 
   /* connect to server */
-  if (connect(s, (const struct sockaddr *)(&server), sizeof(server)) < 0)
+  if (connect(s, (const struct sockaddr *)server, sizeof(*server)) < 0) {
+    addr_host.clear(); /* resolve again next time */
     ret = ERRCONN;
+  }
   else {
     if (pfd)
       *pfd = s;
@@ -479,6 +496,250 @@ HttpRequest::http_retcode HttpRequest::http_parse_url(
   return OK0;
 }
 
+/*
+ * Resolve the server, or proxy, address, if it is not the one held
+ */
+HttpRequest::http_retcode
+HttpRequest::resolve(const struct sockaddr_in **paddr)
+{
+  int proxy = (http_proxy_server.size() && http_proxy_port != 0);
+  std::string host = proxy ? http_proxy_server
+                           : (http_server.size() ? http_server
+                                                 : SERVER_DEFAULT);
+  int port = proxy ? http_proxy_port : http_port;
+
+  if (addr_host != host || addr_port != port) {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addr_host.clear();
+    if (getaddrinfo(host.c_str(), NULL, &hints, &res) != 0)
+      return ERRHOST;
+    memcpy(&addr, res->ai_addr, sizeof(addr));
+    addr.sin_port = (unsigned short)htons(port);
+    freeaddrinfo(res);
+    addr_host = host;
+    addr_port = port;
+  }
+  *paddr = &addr;
+  return OK0;
+}
+
+/*
+ * Open the keep-alive connection, within the connect timeout
+ */
+HttpRequest::http_retcode HttpRequest::open_conn()
+{
+  const struct sockaddr_in *server;
+  http_retcode ret = resolve(&server);
+  if (ret < 0)
+    return ret;
+
+  conn_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (conn_fd < 0)
+    return ERRSOCK;
+  int on = 1;
+  setsockopt(conn_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+  int err = 0;
+  socklen_t err_len = sizeof(err);
+  if (connect(conn_fd, (const struct sockaddr *)server, sizeof(*server)) < 0 &&
+      (errno != EINPROGRESS ||
+       !http_wait(conn_fd, POLLOUT, connect_timeout_ms) ||
+       getsockopt(conn_fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 ||
+       err != 0)) {
+    close_conn();
+    addr_host.clear(); /* resolve again next time */
+    return ERRCONN;
+  }
+  return OK0;
+}
+
+void HttpRequest::close_conn()
+{
+  if (conn_fd >= 0)
+    close(conn_fd);
+  conn_fd = -1;
+  rpos = rlen = 0;
+  sent = false;
+}
+
+/*
+ * Read what is available into the empty read buffer, waiting up to the
+ * read timeout. Returns the number of bytes read, 0 at the end of the
+ * stream, or negative on error or timeout.
+ */
+int HttpRequest::fill_buffer()
+{
+  rpos = rlen = 0;
+  while (1) {
+    ssize_t n = recv(conn_fd, rbuf, sizeof(rbuf), 0);
+    if (n >= 0)
+      return (rlen = n);
+    if (errno != EINTR &&
+        ((errno != EAGAIN && errno != EWOULDBLOCK) ||
+         !http_wait(conn_fd, POLLIN, read_timeout_ms)))
+      return -1;
+  }
+}
+
+/*
+ * Read a line from the buffer, without the LF or a CR before it
+ */
+bool HttpRequest::read_line(std::string &line)
+{
+  line.clear();
+  while (1) {
+    if (rpos == rlen && fill_buffer() <= 0)
+      return false;
+    const char *start = rbuf + rpos;
+    const char *lf = (const char *)memchr(start, '\012', rlen - rpos);
+    int n = lf ? lf - start : rlen - rpos;
+    line.append(start, n);
+    rpos += n + (lf != NULL);
+    if (lf) {
+      if (line.size() && line[line.size() - 1] == '\015')
+        line.resize(line.size() - 1);
+      return true;
+    }
+    if (line.size() > MAXBUF)
+      return false;
+  }
+}
+
+/*
+ * Append length bytes to body, or if length is negative everything up to
+ * the end of the stream
+ */
+bool HttpRequest::read_body(std::string &body, long length)
+{
+  while (length != 0) {
+    if (rpos == rlen) {
+      int n = fill_buffer();
+      if (n == 0 && length < 0)
+        return true;
+      if (n <= 0)
+        return false;
+    }
+    int n = rlen - rpos;
+    if (length >= 0 && length < n)
+      n = length;
+    body.append(rbuf + rpos, n);
+    rpos += n;
+    if (length > 0)
+      length -= n;
+  }
+  return true;
+}
+
+/*
+ * send a GET for fname on the keep-alive connection, opening it if
+ * necessary
+ */
+HttpRequest::http_retcode HttpRequest::send_request()
+{
+  http_retcode ret;
+  if (conn_fd < 0 && (ret = open_conn()) < 0)
+    return ret;
+
+  /* create and send header */
+  int proxy = (http_proxy_server.size() && http_proxy_port != 0);
+  char url[MAXBUF];
+  if (proxy)
+    snprintf(url, sizeof(url), "http://%.128s:%d/%.256s", http_server.c_str(),
+             http_port, fname.c_str());
+  else
+    snprintf(url, sizeof(url), "/%.256s", fname.c_str());
+  char header[MAXBUF * 2];
+  int hlg = snprintf(header, sizeof(header),
+                     "GET %s HTTP/1.1\015\012Host: %.128s:%d\015\012"
+                     "User-Agent: %s\015\012\015\012",
+                     url, http_server.c_str(), http_port, http_user_agent);
+  for (int n = 0; n < hlg;) {
+    ssize_t r = send(conn_fd, header + n, hlg - n, MSG_NOSIGNAL);
+    if (r > 0)
+      n += r;
+    else if (r < 0 && errno == EINTR)
+      continue;
+    else if (r < 0 && errno == EAGAIN &&
+             http_wait(conn_fd, POLLOUT, read_timeout_ms))
+      continue;
+    else
+      return ERRWRHD;
+  }
+  return OK0;
+}
+
+/*
+ * read the response to the request sent. The whole response is read, so
+ * the connection is ready for the next request.
+ */
+HttpRequest::http_retcode HttpRequest::read_response(std::string &body)
+{
+  http_retcode ret;
+  std::string line;
+  int minor = 0;
+  int status;
+  if (!read_line(line))
+    return ERRRDHD;
+  if (sscanf(line.c_str(), "HTTP/1.%d %03d", &minor, &status) != 2)
+    return ERRPAHD;
+  ret = static_cast<http_retcode>(status);
+
+  /* headers, HTTP/1.0 closes by default */
+  long length = -1;
+  bool chunked = false;
+  bool keep_open = (minor > 0);
+  while (1) {
+    if (!read_line(line))
+      return ERRRDHD;
+    if (line.empty()) /* end of header */
+      break;
+    /* convert to lower case 'till a : is found or end of string */
+    for (char *pc = &line[0]; (*pc != ':' && *pc); pc++)
+      *pc = tolower(*pc);
+    const char *hd = line.c_str();
+    sscanf(hd, "content-length: %ld", &length);
+    if (strncmp(hd, "transfer-encoding:", 18) == 0 && strstr(hd, "chunked"))
+      chunked = true;
+    if (strncmp(hd, "connection:", 11) == 0)
+      keep_open = (strcasestr(hd, "keep-alive") != NULL);
+  }
+
+  if (status == 204 || status == 304) /* no body */
+    length = 0;
+
+  /* body, read even for an error, to leave the connection in step */
+  if (chunked) {
+    long chunk;
+    do {
+      if (!read_line(line) || sscanf(line.c_str(), "%lx", &chunk) != 1)
+        return ERRRDDT;
+      if (chunk > 0 && (!read_body(body, chunk) || !read_line(line)))
+        return ERRRDDT;
+    } while (chunk > 0);
+    do {
+      if (!read_line(line))
+        return ERRRDDT;
+    } while (line.size()); /* trailer */
+  }
+  else if (!read_body(body, length))
+    return ERRRDDT;
+  else if (length < 0)
+    keep_open = false; /* read to the end */
+
+  if (!keep_open)
+    close_conn();
+  return ret;
+}
+
+void HttpRequest::set_timeouts(int connect_ms, int read_ms)
+{
+  connect_timeout_ms = connect_ms;
+  read_timeout_ms = read_ms;
+}
+
 HttpRequest::http_retcode HttpRequest::set_url(const std::string &url)
 {
   fname.clear();
@@ -486,21 +747,61 @@ HttpRequest::http_retcode HttpRequest::set_url(const std::string &url)
   char *url_c_str = strdup(url.c_str());
   auto ret = http_parse_url(url_c_str, &filename);
   free(url_c_str);
-  fname = filename;
+  fname = filename ? filename : "";
   free(filename);
+  close_conn(); /* the server may have changed */
   return ret;
 }
 
+/*
+ * a kept connection may have been closed by the server while unused, so
+ * a request that fails on it is tried once on a new connection
+ */
+bool HttpRequest::start_get()
+{
+  sent_reused = (conn_fd >= 0);
+  http_retcode ret = send_request();
+  if (ret < 0 && sent_reused) {
+    close_conn();
+    sent_reused = false;
+    ret = send_request();
+  }
+  if (ret < 0)
+    close_conn();
+  sent = (ret == OK0);
+  return sent;
+}
+
+bool HttpRequest::finish_get(std::string &data)
+{
+  data.clear();
+  if (!sent)
+    return false;
+  sent = false;
+  http_retcode ret = read_response(data);
+  if (ret < 0 && sent_reused) {
+    close_conn();
+    data.clear();
+    if ((ret = send_request()) == OK0)
+      ret = read_response(data);
+  }
+  if (ret < 0)
+    close_conn();
+  if (ret != 200)
+    data.clear();
+  return ret == 200;
+}
+
+bool HttpRequest::get(std::string &data)
+{
+  start_get();
+  return finish_get(data);
+}
+
 std::string HttpRequest::get()
 {
   std::string data_str;
-  char *data = nullptr;
-  char typebuf[70];
-  int lg;
-  auto ret = http_get(fname.c_str(), &data, &lg, typebuf);
-  if (ret == 200)
-    data_str.assign(data, lg);
-  free(data);
+  get(data_str);
   return data_str;
 }
 
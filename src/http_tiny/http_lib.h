@@ -10,8 +10,14 @@
  *
  * Modified by Adrian Rossiter <adrian@antiprism.com> 11/11/2019:
  *   Compile with C++. Wrap in class to remove global variables.
+ *
+ * Modified by Adrian Rossiter <adrian@antiprism.com> 2026:
+ *   get() keeps an HTTP/1.1 connection open between requests, with the
+ *   server address cached, buffered reads and connect and read timeouts.
+ *   start_get() and finish_get() split a get() around other work.
  */
 
+#include <netinet/in.h>
 #include <string>
 
 
@@ -60,11 +66,45 @@ private:
   int http_proxy_port = 0;
   std::string fname;
 
+  /* server address, resolved for addr_host:addr_port */
+  struct sockaddr_in addr;
+  std::string addr_host;
+  int addr_port = 0;
+
+  /* keep-alive connection used by get(), or -1 */
+  int conn_fd = -1;
+  int connect_timeout_ms = 1000;
+  int read_timeout_ms = 2000;
+
+  /* data received on conn_fd, and not yet used, from rbuf[rpos] */
+  char rbuf[4096];
+  int rpos = 0;
+  int rlen = 0;
+
+  /* a GET has been sent and its response not yet read, and whether it
+     was sent on a connection kept from an earlier request */
+  bool sent = false;
+  bool sent_reused = false;
+
+  http_retcode resolve(const struct sockaddr_in **paddr);
+  http_retcode open_conn();
+  void close_conn();
+  int fill_buffer();
+  bool read_line(std::string &line);
+  bool read_body(std::string &body, long length);
+  http_retcode send_request();
+  http_retcode read_response(std::string &body);
+
   http_retcode http_query(const char *command, const char *url,
                           const char *additional_header, querymode mode,
                           const char *data, int length, int *pfd);
 
 public:
+  HttpRequest() {}
+  ~HttpRequest() { close_conn(); }
+  HttpRequest(const HttpRequest &) = delete;
+  HttpRequest &operator=(const HttpRequest &) = delete;
+
   http_retcode http_put(const char *filename, char *data, int length, int overwrite,
                         char *type);
   http_retcode http_get(const char *filename, char **pdata, int *plength,
@@ -75,6 +115,17 @@ public:
   http_retcode set_proxy(char *proxy);
 
   http_retcode set_url(const std::string &url);
+  /* set the time allowed to connect, and to wait for each read */
+  void set_timeouts(int connect_ms, int read_ms);
+  /* get the url resource into data, reusing its memory, returns true if
+     the server answered 200. The connection is kept open for the next
+     request, if the server allows it */
+  bool get(std::string &data);
   std::string get();
+  /* get() in two parts, so the caller can do other work while the server
+     answers: send the request, and later read the response into data.
+     start_get() returns false if the request could not be sent */
+  bool start_get();
+  bool finish_get(std::string &data);
 
 };
@@ -60,16 +60,20 @@ public:
 
   ~converter() { iconv_close(iconv_); }
 
+  // The input is not copied, and the output is converted into buffers
+  // kept for the thread, so a conversion only allocates while the
+  // buffers grow to fit the longest text.
   void convert(const std::string &input, std::string &output) const
   {
-    // copy the string to a buffer as iconv function requires a non-const char
-    // pointer.
-    std::vector<char> in_buf(input.begin(), input.end());
-    char *src_ptr = &in_buf[0];
+    // iconv does not change the input, but takes a non-const char pointer.
+    char *src_ptr = const_cast<char *>(input.data());
     size_t src_size = input.size();
 
-    std::vector<char> buf(buf_size_);
-    std::string dst;
+    static thread_local std::vector<char> buf;
+    static thread_local std::string dst;
+    if (buf.size() < buf_size_)
+      buf.resize(buf_size_);
+    dst.clear();
     while (0 < src_size) {
       char *dst_ptr = &buf[0];
       size_t dst_size = buf.size();
@@ -89,6 +93,7 @@ public:
       }
       dst.append(&buf[0], buf.size() - dst_size);
     }
+    // the old output memory is kept for the next conversion
     dst.swap(output);
   }
 
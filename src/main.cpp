@@ -26,8 +26,10 @@
 #include "display_info.h"
 #include "player.h"
 #include "programopts.h"
+#include "spectrum.h"
 #include "timer.h"
 #include "utils.h"
+#include "widget.h"
 
 #include <errno.h>
 #include <locale.h>
@@ -37,9 +39,12 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <math.h>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -49,14 +54,48 @@ using std::vector;
 const int SPECT_WIDTH = 64;
 
 ArduiPi_OLED display; // global, for use during signal handling
+Ticker frame_ticker;  // global, for the timing report at exit
+const mpd_client *mpd_stats = nullptr; // MPD connection, for the report
 
 void cleanup(void)
 {
   // Clear and close display
   display.invertDisplay(false);
+  display.stopHardwareScroll();
+  display.setDamageTracking(false);
   display.clearDisplay();
   display.display();
+  // Send the waiting frame, and stop the thread that updates the
+  // transport statistics
+  display.stopFlushThread();
+
+  // Report the modelled bus use of a virtual display
+  OLED_Virtual_Transport *virt =
+      dynamic_cast<OLED_Virtual_Transport *>(display.getTransport());
+  if (virt && virt->getFrames()) {
+    const double frames = virt->getFrames();
+    fprintf(stderr,
+            "virtual OLED: %u frames, per frame: %.1f messages, %.1f bytes, "
+            "%.3f ms bus time\n",
+            virt->getFrames(), virt->getMessages() / frames,
+            virt->getBytes() / frames, 1000 * virt->getBusSecs() / frames);
+  }
   display.close();
+
+  // Report how well the frame deadlines were kept
+  if (frame_ticker.get_ticks())
+    fprintf(stderr,
+            "frame timer: %ld ticks, %ld overruns, lateness: mean %.0f us, "
+            "max %ld us\n",
+            frame_ticker.get_ticks(), frame_ticker.get_overruns(),
+            frame_ticker.get_mean_jitter_usecs(),
+            frame_ticker.get_max_jitter_usecs());
+  if (mpd_stats && mpd_stats->get_queries())
+    fprintf(stderr,
+            "MPD: %ld status queries, mean %.0f us, max %ld us, "
+            "%ld reconnects\n",
+            mpd_stats->get_queries(), mpd_stats->get_mean_query_usecs(),
+            mpd_stats->get_max_query_usecs(), mpd_stats->get_reconnects());
 }
 
 void signal_handler(int sig)
@@ -99,13 +138,16 @@ public:
   int framerate = 15;                  // frame rate in Hz
   int bars = 16;                       // number of bars in spectrum
   int gap = 1;                         // gap between bars, in pixels
+  char spect_style = 'b';              // b bars, m mirrored, p peaks, o outline
   vector<double> scroll;   // rate (pixels per sec), start delay (secs)
+  bool hw_scroll = false;  // scroll title and artist in the OLED hardware
   int clock_format = 0;    // 0-3: 0,1 - 24h  2,3 - 12h  0,2 - leading 0
   int date_format = 0;     // 0: DD-MM-YYYY, 1: MM-DD-YYYY
   char pause_screen = 'p'; // p - play, s - stop
   string cava_prog_name = "mpd_oled_cava"; // cava executable name
   string cava_method = "fifo";             // fifo, alsa or pulse
   string cava_source;                      // Path to FIFO / alsa device
+  char analyser = 'c'; // spectrum analyser: c - cava, b - built-in
   double invert = 0;             // 0 normal, -1 invert, n>0 invert every n hrs
   bool rotate180 = false;        // display upside down
   unsigned char i2c_addr = 0;    // number of I2C address
@@ -114,6 +156,12 @@ public:
   int spi_dc_gpio = OLED_SPI_DC; // SPI DC
   int spi_cs = OLED_SPI_CS0;     // SPI CS - 0: CS0, 1: CS1
   Player player;
+  string mpd_host;               // MPD host or socket path, "" for default
+  int mpd_port = 0;              // MPD port, 0 for default
+  string mpd_password;           // MPD password
+  int virtual_hz = 0;            // virtual OLED bus clock, 0 for hardware
+  string virtual_pbm;            // virtual OLED frame image file
+  double wifi_link_secs = 5;     // interval between WiFi link samples
 
   OledOpts() : ProgramOpts("mpd_oled", "0.02")
   {
@@ -150,6 +198,8 @@ Options
   fprintf(stdout,
           R"(  -b <num>   number of bars to display (default: 16)
   -g <sz>    gap between bars in, pixels (default: 1)
+  -t <val>   spectrum style: b - bars (default), m - mirrored about the
+             middle, p - bars with falling peak dots, o - outlined bars
   -f <hz>    framerate in Hz (default: 15)
   -s <vals>  scroll rate (pixels per second) and start delay (seconds), up
              to four comma separated decimal values (default: %.1f,%.1f) as:
@@ -157,6 +207,10 @@ Options
                 rate_all,delay_all
                 rate_title,delay_all,rate_artist
                 rate_title,delay_title,rate_artist,delay_artist
+  -H         scroll the title and artist in the OLED hardware, which sends
+             much less to the OLED (SSD1306 only). Both lines scroll at the
+             title rate, rounded to a rate the OLED supports, after the
+             title delay
   -C <fmt>   clock format: 0 - 24h leading 0 (default), 1 - 24h no leading 0,
                 2 - 24h leading 0, 3 - 24h no leading 0
   -d         use USA date format MM-DD-YYYY (default: DD-MM-YYYY)
@@ -164,16 +218,27 @@ Options
   -k         cava executable name is cava (default: mpd_oled_cava)
   -c         cava input method and source (default: '%s,%s')
              e.g. 'fifo,/tmp/my_fifo', 'alsa,hw:5,0', 'pulse'
+  -A <val>   spectrum analyser: c - cava (default), b - built-in, which
+             reads the FIFO given with -c directly (falls back to cava if
+             the FIFO cannot be read)
   -R         rotate display 180 degrees
   -I <val>   invert black/white: n - normal (default), i - invert,
              number - switch between n and i with this period (hours), which
              may help avoid screen burn
   -a <addr>  I2C address, in hex (default: default for OLED type)
+  -L <secs>  interval between readings of the WiFi link quality (default:
+             5.0)
   -B num     I2C bus number (default: 1, giving device /dev/i2c-1)
   -r <gpio>  I2C/SPI reset GPIO number, if needed (default: 25)
   -D <gpio>  SPI DC GPIO number (default: 24)
   -S <num>   SPI CS number (default: 0)
   -p <plyr>  Player: mpd, moode, volumio, runeaudio (default: detected)
+  -m <conn>  MPD connection as host, host:port, [IPv6 address]:port or
+             UNIX socket path, which may be preceded by password@ (default:
+             MPD_HOST and MPD_PORT environment variables, or localhost:6600)
+  -v <clk>   use a virtual OLED, no hardware, with a modelled bus clock in
+             Hz (e.g. 400000 for I2C), optionally followed by ,file to write
+             each frame to as a PBM image, %%d in file is the frame number
 Example :
 %s -o 6 use a %s OLED
 )",
@@ -189,8 +254,8 @@ void OledOpts::process_command_line(int argc, char **argv)
 
   handle_long_opts(argc, argv);
 
-  while ((c = getopt(argc, argv, ":ho:b:g:f:s:C:dP:kc:RI:a:B:r:D:S:p:")) !=
-         -1) {
+  while ((c = getopt(argc, argv,
+                     ":ho:b:g:t:f:s:HC:dP:kc:A:RI:L:a:B:r:D:S:p:m:v:")) != -1) {
     if (common_opts(c, optopt))
       continue;
 
@@ -214,6 +279,13 @@ void OledOpts::process_command_line(int argc, char **argv)
         error("gap must be between 0 and 30 pixels", c);
       break;
 
+    case 't':
+      if (strlen(optarg) == 1 && strchr("bmpo", *optarg))
+        spect_style = *optarg;
+      else
+        error("spectrum style is not b, m, p or o", c);
+      break;
+
     case 'f':
       print_status_or_exit(read_int(optarg, &framerate), c);
       if (framerate < 1)
@@ -244,6 +316,10 @@ void OledOpts::process_command_line(int argc, char **argv)
 
       break;
 
+    case 'H':
+      hw_scroll = true;
+      break;
+
     case 'C':
       print_status_or_exit(read_int(optarg, &clock_format), c);
       if (clock_format < 0 || clock_format > 3)
@@ -293,6 +369,15 @@ void OledOpts::process_command_line(int argc, char **argv)
       cava_source = &optarg[method_len];
       break;
 
+    case 'A':
+      if (strcmp(optarg, "c") == 0)
+        analyser = 'c';
+      else if (strcmp(optarg, "b") == 0)
+        analyser = 'b';
+      else
+        error("spectrum analyser type is not c or b", c);
+      break;
+
     case 'R':
       rotate180 = true;
       break;
@@ -317,6 +402,12 @@ void OledOpts::process_command_line(int argc, char **argv)
       i2c_addr = (unsigned char)strtol(optarg, NULL, 16);
       break;
 
+    case 'L':
+      print_status_or_exit(read_double(optarg, &wifi_link_secs), c);
+      if (wifi_link_secs <= 0)
+        error("WiFi link interval must be a positive number", c);
+      break;
+
     case 'B':
       print_status_or_exit(read_int(optarg, &i2c_bus), c);
       if (i2c_bus < 0)
@@ -355,6 +446,58 @@ void OledOpts::process_command_line(int argc, char **argv)
       break;
     }
 
+    case 'm': {
+      string conn = optarg;
+      size_t at = conn.rfind('@');
+      if (at != string::npos) {
+        mpd_password = conn.substr(0, at);
+        conn = conn.substr(at + 1);
+      }
+      // A port follows the last colon of host:port or [IPv6 address]:port,
+      // a bare IPv6 address has more than one colon and no port
+      size_t colon = string::npos;
+      if (conn.size() && conn[0] == '[') {
+        size_t end = conn.find(']');
+        if (end == string::npos)
+          error("IPv6 address has no closing ']'", c);
+        if (end + 1 < conn.size()) {
+          if (conn[end + 1] != ':')
+            error("IPv6 address in brackets must be followed by :port", c);
+          colon = end + 1;
+        }
+      }
+      else if (conn.size() && conn[0] != '/' &&
+               std::count(conn.begin(), conn.end(), ':') == 1)
+        colon = conn.find(':');
+      if (colon != string::npos) {
+        print_status_or_exit(read_int(conn.substr(colon + 1).c_str(),
+                                      &mpd_port),
+                             c);
+        if (mpd_port < 1 || mpd_port > 65535)
+          error("MPD port must be between 1 and 65535", c);
+        conn.resize(colon);
+      }
+      if (conn.size() && conn[0] == '[')
+        conn = conn.substr(1, conn.find(']') - 1);
+      mpd_host = conn;
+      break;
+    }
+
+    case 'v': {
+      string arg = optarg;
+      size_t comma = arg.find(',');
+      if (comma != string::npos) {
+        virtual_pbm = arg.substr(comma + 1);
+        if (virtual_pbm.empty())
+          error("virtual OLED image file name is empty", c);
+        arg.resize(comma);
+      }
+      print_status_or_exit(read_int(arg.c_str(), &virtual_hz), c);
+      if (virtual_hz < 1)
+        error("virtual OLED bus clock must be a positive integer", c);
+      break;
+    }
+
     default:
       error("unknown command line error");
     }
@@ -366,6 +509,9 @@ void OledOpts::process_command_line(int argc, char **argv)
   if (oled == 0)
     error("must specify a 128x64 oled", 'o');
 
+  if (analyser == 'b' && cava_method != "fifo")
+    error("built-in spectrum analyser requires a FIFO input (see -c)", 'A');
+
   const int min_spect_width = bars + (bars - 1) * gap; // assume bar width = 1
   if (min_spect_width > SPECT_WIDTH)
     error(msg_str(
@@ -437,78 +583,265 @@ Status start_cava(FILE **p_fifo_file, const OledOpts &opts)
   return Status::ok();
 }
 
-// Draw fullscreen 128x64 clock/date
-void draw_clock(ArduiPi_OLED &display, const display_info &disp_info)
+// Fingerprints of values shown by more than one widget
+static uint64_t conn_fprint(const display_info &disp_info)
+{
+  const connection_info &conn = disp_info.conn();
+  return fingerprint().add(conn.get_type()).add(conn.get_link()).get();
+}
+
+static uint64_t minute_fprint(const display_info &disp_info)
+{
+  // Time zones are offset by whole minutes
+  return fingerprint()
+      .add(time(0) / 60)
+      .add(disp_info.clock_format)
+      .add(disp_info.date_format)
+      .get();
+}
+
+// Fullscreen 128x64 clock/date
+static void add_clock_widgets(widget_screen &screen)
 {
-  display.clearDisplay();
   // const int H = 8;  // character height
   const int W = 6; // character width
-  draw_text(display, 22, 0, 16, disp_info.conn.get_ip_addr());
-  draw_connection(display, 128 - 2 * W, 0, disp_info.conn);
-  draw_time(display, 4, 16, 4, disp_info.clock_format);
-  draw_date(display, 32, 56, 1, disp_info.date_format);
+  screen.add(
+      22, 0, 128 - 2 * W - 22, 8,
+      [](const display_info &disp_info) {
+        return fingerprint().add(disp_info.conn().get_ip_addr()).get();
+      },
+      [](ArduiPi_OLED &display, const display_info &disp_info) {
+        draw_text(display, 22, 0, 16, disp_info.conn().get_ip_addr());
+      });
+  screen.add(128 - 2 * W, 0, 2 * W, 8, conn_fprint,
+             [](ArduiPi_OLED &display, const display_info &disp_info) {
+               draw_connection(display, 128 - 2 * W, 0, disp_info.conn());
+             });
+  screen.add(4, 16, 124, 32, minute_fprint,
+             [](ArduiPi_OLED &display, const display_info &disp_info) {
+               draw_time(display, 4, 16, 4, disp_info.clock_format);
+             });
+  screen.add(32, 56, 10 * W, 8, minute_fprint,
+             [](ArduiPi_OLED &display, const display_info &disp_info) {
+               draw_date(display, 32, 56, 1, disp_info.date_format);
+             });
 }
 
-void draw_spect_display(ArduiPi_OLED &display, const display_info &disp_info)
+// A line of text, 20 characters wide, scrolled when it is longer. Text
+// scrolled by the OLED hardware is only redrawn every hw_scroll_step
+// pixels, and uses the whole width.
+static void add_scroll_text_widget(widget_screen &screen, int y,
+                                   const string &(mpd_info::*get_text)() const,
+                                   const vector<double> &scroll,
+                                   bool hw_scroll)
 {
-  const int H = 8; // character height
   const int W = 6; // character width
-  draw_spectrum(display, 0, 0, SPECT_WIDTH, 32, disp_info.spect);
-  draw_connection(display, 128 - 2 * W, 0, disp_info.conn);
-  draw_triangle_slider(display, 128 - 5 * W, 1, 11, 6,
-                       disp_info.status.get_volume());
-  if (disp_info.status.get_kbitrate() > 0)
-    draw_text(display, 128 - 10 * W, 0, 4, disp_info.status.get_kbitrate_str());
-
-  int clock_offset = (disp_info.clock_format < 2) ? 0 : -2;
-  draw_time(display, 128 - 10 * W + clock_offset, 2 * H, 2,
-            disp_info.clock_format);
+  auto strip = std::make_shared<text_strip>();
+  screen.add(
+      0, y, hw_scroll ? 128 : 20 * W, 8,
+      [get_text, scroll, hw_scroll](const display_info &disp_info) {
+        const string &str = (disp_info.status().*get_text)();
+        const double secs = disp_info.text_change.secs();
+        return fingerprint()
+            .add(disp_info.text_gen)
+            .add(hw_scroll ? text_hw_scroll_offset(str, 20, scroll, secs)
+                           : text_scroll_offset(str, 20, scroll, secs))
+            .get();
+      },
+      [get_text, scroll, hw_scroll, y, strip](ArduiPi_OLED &display,
+                                              const display_info &disp_info) {
+        const string &str = (disp_info.status().*get_text)();
+        const double secs = disp_info.text_change.secs();
+        if (hw_scroll)
+          draw_text_hw_scroll(display, y, 20, str,
+                              text_hw_scroll_offset(str, 20, scroll, secs),
+                              *strip);
+        else
+          draw_text_scroll(display, 0, y, 20, str, scroll, secs, *strip);
+      });
+}
 
+static void add_spect_widgets(widget_screen &screen,
+                              const display_info &disp_info)
+{
+  const int H = 8; // character height
+  const int W = 6; // character width
+  screen.add(
+      0, 0, SPECT_WIDTH, 32,
+      [](const display_info &disp_info) {
+        const spect_graph &spect = disp_info.spect;
+        return fingerprint()
+            .add(spect.heights.data(), spect.heights.size())
+            .add(spect.gap)
+            .add(spect.peaks.data(),
+                 (spect.style == 'p') ? spect.peaks.size() : 0)
+            .get();
+      },
+      [](ArduiPi_OLED &display, const display_info &disp_info) {
+        draw_spectrum(display, 0, 0, SPECT_WIDTH, 32, disp_info.spect);
+      });
+  screen.add(128 - 2 * W, 0, 2 * W, 8, conn_fprint,
+             [](ArduiPi_OLED &display, const display_info &disp_info) {
+               draw_connection(display, 128 - 2 * W, 0, disp_info.conn());
+             });
+  screen.add(
+      128 - 5 * W, 1, 11, 6,
+      [](const display_info &disp_info) {
+        return (uint64_t)disp_info.status().get_volume();
+      },
+      [](ArduiPi_OLED &display, const display_info &disp_info) {
+        draw_triangle_slider(display, 128 - 5 * W, 1, 11, 6,
+                             disp_info.status().get_volume());
+      });
+  screen.add(
+      128 - 10 * W, 0, 4 * W, 8,
+      [](const display_info &disp_info) {
+        return fingerprint()
+            .add(disp_info.status().get_kbitrate() > 0)
+            .add(disp_info.snap->kbitrate_str)
+            .get();
+      },
+      [](ArduiPi_OLED &display, const display_info &disp_info) {
+        if (disp_info.status().get_kbitrate() > 0)
+          draw_text(display, 128 - 10 * W, 0, 4, disp_info.snap->kbitrate_str);
+      });
+  screen.add(128 - 10 * W - 2, 2 * H, 10 * W + 2, 2 * H, minute_fprint,
+             [](ArduiPi_OLED &display, const display_info &disp_info) {
+               int clock_offset = (disp_info.clock_format < 2) ? 0 : -2;
+               draw_time(display, 128 - 10 * W + clock_offset, 2 * H, 2,
+                         disp_info.clock_format);
+             });
+
+  // Scrolling text changes with the text generation and the scroll offset
   vector<double> scroll_origin(disp_info.scroll.begin() + 2,
                                disp_info.scroll.begin() + 4);
-  draw_text_scroll(display, 0, 4 * H + 4, 20, disp_info.status.get_origin(),
-                   scroll_origin, disp_info.text_change.secs());
-
+  add_scroll_text_widget(screen, 4 * H + 4, &mpd_info::get_origin,
+                         scroll_origin, disp_info.hw_scroll);
   vector<double> scroll_title(disp_info.scroll.begin(),
                               disp_info.scroll.begin() + 2);
-  draw_text_scroll(display, 0, 6 * H, 20, disp_info.status.get_title(),
-                   scroll_title, disp_info.text_change.secs());
+  add_scroll_text_widget(screen, 6 * H, &mpd_info::get_title, scroll_title,
+                         disp_info.hw_scroll);
+
+  // Progress changes with the bar width, as calculated by the slider
+  screen.add(
+      0, 7 * H + 6, 128, 2,
+      [](const display_info &disp_info) {
+        const float percent = 100 * disp_info.status().get_progress();
+        return (uint64_t)(int)(128 * percent / 100.0 + 0.5);
+      },
+      [](ArduiPi_OLED &display, const display_info &disp_info) {
+        draw_solid_slider(display, 0, 7 * H + 6, 128, 2,
+                          100 * disp_info.status().get_progress());
+      });
+}
+
+// Restart the hardware scroll of the origin and title pages each time
+// their text is redrawn, and stop it when neither is scrolling
+static void update_hw_scroll(ArduiPi_OLED &display,
+                             const display_info &disp_info, bool spect_shown)
+{
+  static bool scrolling = false;
+  static uint64_t last_fprint = 0;
+  const int H = 8; // character height
+  int origin_offset = -1;
+  int title_offset = -1;
+  if (spect_shown) {
+    const double secs = disp_info.text_change.secs();
+    origin_offset = text_hw_scroll_offset(disp_info.status().get_origin(), 20,
+                                          disp_info.scroll, secs);
+    title_offset = text_hw_scroll_offset(disp_info.status().get_title(), 20,
+                                         disp_info.scroll, secs);
+  }
 
-  draw_solid_slider(display, 0, 7 * H + 6, 128, 2,
-                    100 * disp_info.status.get_progress());
+  if (origin_offset < 0 && title_offset < 0) {
+    if (scrolling)
+      display.stopHardwareScroll();
+    scrolling = false;
+    return;
+  }
+
+  const uint64_t fprint = fingerprint()
+                              .add(disp_info.text_gen)
+                              .add(origin_offset)
+                              .add(title_offset)
+                              .get();
+  if (scrolling && fprint == last_fprint)
+    return;
+
+  // Origin is in pages 4 and 5, title in page 6
+  const int page_first = (origin_offset >= 0) ? (4 * H + 4) / 8 : 6 * H / 8;
+  const int page_last = (title_offset >= 0) ? 6 * H / 8 : (5 * H + 3) / 8;
+  display.setHardwareScroll(page_first, page_last, disp_info.scroll[0]);
+  scrolling = true;
+  last_fprint = fprint;
 }
 
+// Draw the widgets of the current screen that have changed
 void draw_display(ArduiPi_OLED &display, const display_info &disp_info)
 {
-  mpd_state state = disp_info.status.get_state();
+  static widget_screen clock_screen;
+  static widget_screen spect_screen;
+  static widget_screen *shown = nullptr;
+  if (shown == nullptr) {
+    add_clock_widgets(clock_screen);
+    add_spect_widgets(spect_screen, disp_info);
+  }
+
+  mpd_state state = disp_info.status().get_state();
+  widget_screen *screen = &spect_screen;
   if (state == MPD_STATE_UNKNOWN || state == MPD_STATE_STOP ||
       (state == MPD_STATE_PAUSE && disp_info.pause_screen == 's'))
-    draw_clock(display, disp_info);
-  else
-    draw_spect_display(display, disp_info);
+    screen = &clock_screen;
+  screen->draw(display, disp_info, screen != shown);
+  shown = screen;
+  if (disp_info.hw_scroll)
+    update_hw_scroll(display, disp_info, screen == &spect_screen);
 }
 
 namespace {
-pthread_mutex_t disp_info_lock;
+// Status values, updated in the status thread
+struct status_updater {
+  mpd_info status;
+  net_monitor net;
+  connection_info conn;
+  status_buffer buf;
+  unsigned text_gen = 0;
+  std::string last_title;
+  std::string last_origin;
+  mpd_state last_state = MPD_STATE_UNKNOWN;
+
+  void publish();
+};
+
+void status_updater::publish()
+{
+  if (status.get_title() != last_title || status.get_origin() != last_origin ||
+      status.get_state() != last_state) {
+    last_title = status.get_title();
+    last_origin = status.get_origin();
+    last_state = status.get_state();
+    text_gen++;
+  }
+
+  status_snapshot &snap = buf.get_back();
+  snap.status = status;
+  snap.conn = conn;
+  snap.kbitrate_str = status.get_kbitrate_str();
+  snap.text_gen = text_gen;
+  buf.publish();
 }
+} // namespace
 
 void *update_info(void *data)
 {
-  const float delay_secs = 0.3;
-  display_info *disp_info_orig = (display_info *)data;
+  status_updater *updater = (status_updater *)data;
   while (true) {
-    pthread_mutex_lock(&disp_info_lock);
-    display_info disp_info = *disp_info_orig;
-    pthread_mutex_unlock(&disp_info_lock);
-
-    disp_info.status.init(); // Update MPD status info
-    disp_info.conn_init();   // Update connection info
-
-    pthread_mutex_lock(&disp_info_lock);
-    disp_info_orig->update_from(disp_info);
-    pthread_mutex_unlock(&disp_info_lock);
-
-    usleep(delay_secs * 1000000);
+    // Sleep in MPD idle until something changes
+    unsigned changed = updater->status.wait_for_change(
+        {updater->net.get_fd()}, updater->net.get_wait_secs());
+    updater->status.init(changed);       // Update MPD status info
+    updater->net.update(updater->conn); // Update connection info
+    updater->publish();
   }
 };
 
@@ -521,98 +854,159 @@ int start_idle_loop(ArduiPi_OLED &display, const OledOpts &opts)
 {
   const double update_sec =
       1 / (0.9 * opts.framerate); // default update freq just under framerate
-  const long select_usec =
-      update_sec * 1100000; // slightly longer, but still less than framerate
-  Timer timer;
+  if (!frame_ticker.start(update_sec)) {
+    fprintf(stderr, "error: could not create frame timer\n");
+    return 3;
+  }
+
+  static status_updater updater;
+  updater.status.set_player(opts.player);
+  updater.status.set_server(opts.mpd_host, opts.mpd_port, opts.mpd_password);
+  mpd_stats = &updater.status.get_client();
+  updater.status.init();
+  updater.net.set_link_interval(opts.wifi_link_secs);
+  if (!updater.net.open())
+    opts.warning("could not monitor the network connection: " +
+                 string(strerror(errno)));
+  updater.net.update(updater.conn);
+  updater.publish();
 
   display_info disp_info;
   disp_info.scroll = opts.scroll;
+  if (opts.hw_scroll && opts.scroll[0] > 0) {
+    if (display.hasHardwareScroll()) {
+      // Both lines scroll together, at a rate the OLED supports
+      const double rate = display.getHardwareScrollRate(opts.scroll[0]);
+      disp_info.scroll = {rate, opts.scroll[1], rate, opts.scroll[1]};
+      disp_info.hw_scroll = true;
+    }
+    else
+      opts.warning("OLED has no hardware scroll, scrolling text in software");
+  }
   disp_info.clock_format = opts.clock_format;
   disp_info.date_format = opts.date_format;
   disp_info.pause_screen = opts.pause_screen;
-  disp_info.spect.init(opts.bars, opts.gap);
-  disp_info.status.set_player(opts.player);
-  disp_info.status.init();
+  disp_info.spect.init(opts.bars, opts.gap, opts.spect_style,
+                       opts.framerate);
+  disp_info.update_from(updater.buf);
 
   // Update MPD info in separate thread to avoid stuttering in the spectrum
-  // animation.
+  // animation. The render loop only reads published status snapshots.
   pthread_t update_info_thread;
   if (pthread_create(&update_info_thread, NULL, update_info,
-                     (void *)(&disp_info))) {
+                     (void *)(&updater))) {
     fprintf(stderr, "error: could not create pthread\n");
     return 1;
   }
 
-  if (pthread_mutex_init(&disp_info_lock, NULL) != 0) {
-    fprintf(stderr, "error: could not create pthread mutex\n");
-    return 2;
-  }
-
-  // Cava not yet started
+  // Spectrum input, from cava or the built-in analyser, not yet started
   int fifo_fd = -1;
   FILE *fifo_file = nullptr;
+  bool use_analyser = (opts.analyser == 'b');
+  spect_analyser analyser;
 
-  int zero_read_cnt = 0; // number of consecutive reads of zero bytes
+  int zero_read_cnt = 0; // number of consecutive frame ticks without bars
+  bool bars_since_tick = false;
   while (true) {
-    int num_bars_read = 0;
-    if (fifo_fd >= 0) {
-      fd_set set;
-      FD_ZERO(&set);
+    // Wait for spectrum data or the next frame deadline
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(frame_ticker.get_fd(), &set);
+    if (fifo_fd >= 0)
       FD_SET(fifo_fd, &set);
+    int max_fd = std::max(frame_ticker.get_fd(), fifo_fd);
+    if (select(max_fd + 1, &set, NULL, NULL, NULL) < 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "error: waiting for input: %s\n", strerror(errno));
+      return 4;
+    }
 
-      // FIFO read timeout value
-      struct timeval timeout;
-      timeout.tv_sec = 0;
-      timeout.tv_usec = select_usec; // slightly longer than timer
-
-      // If there is data read it all.
-      if (select(FD_SETSIZE, &set, NULL, NULL, &timeout) > 0) {
-        do {
-          num_bars_read =
-              fread(&disp_info.spect.heights[0], sizeof(unsigned char),
-                    disp_info.spect.heights.size(), fifo_file);
-
-          FD_ZERO(&set);
-          FD_SET(fifo_fd, &set);
-          timeout.tv_sec = 0;
-          timeout.tv_usec = 0;
-        } while (select(FD_SETSIZE, &set, NULL, NULL, &timeout) > 0);
+    // If there is data read it all.
+    int num_bars_read = 0;
+    if (fifo_fd >= 0 && FD_ISSET(fifo_fd, &set) && analyser.is_open()) {
+      int samples_read = analyser.read();
+      if (samples_read < 0) {
+        opts.warning("could not read audio FIFO, using cava: " +
+                     string(strerror(errno)));
+        analyser.close();
+        fifo_fd = -1;
+        use_analyser = false;
+      }
+      else if (samples_read > 0) {
+        zero_read_cnt = 0;
+        bars_since_tick = true;
       }
     }
-
-    if (num_bars_read == 0)
-      zero_read_cnt++;
-    else
+    else if (fifo_fd >= 0 && FD_ISSET(fifo_fd, &set)) {
+      struct timeval timeout;
+      do {
+        num_bars_read =
+            fread(&disp_info.spect.heights[0], sizeof(unsigned char),
+                  disp_info.spect.heights.size(), fifo_file);
+        if (num_bars_read == 0 && feof(fifo_file)) {
+          fifo_fd = -1; // cava has finished, stop waiting on its output
+          break;
+        }
+
+        FD_ZERO(&set);
+        FD_SET(fifo_fd, &set);
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 0;
+      } while (select(fifo_fd + 1, &set, NULL, NULL, &timeout) > 0);
+    }
+    if (num_bars_read) {
       zero_read_cnt = 0;
+      bars_since_tick = true;
+    }
+
+    const bool tick = frame_ticker.ack() > 0;
+    if (tick) {
+      // Analyse the latest audio once per frame
+      if (bars_since_tick && analyser.is_open())
+        analyser.update(disp_info.spect);
+      if (!bars_since_tick)
+        zero_read_cnt++;
+      bars_since_tick = false;
+    }
+
+    // Pick up the latest status values
+    disp_info.update_from(updater.buf);
 
     // Clear spectrum data if no data available or music not playing
-    if (zero_read_cnt > 1 || disp_info.status.get_state() != MPD_STATE_PLAY) {
+    if (zero_read_cnt > 1 || disp_info.status().get_state() != MPD_STATE_PLAY)
       std::fill(disp_info.spect.heights.begin(), disp_info.spect.heights.end(),
                 0);
-      usleep(0.1 * 1000000); // 0.1 sec delay, don't idle too fast if no need
-    }
+    if (tick)
+      disp_info.spect.update_peaks();
 
     // Update display if necessary
-    if (timer.finished() || num_bars_read) {
-      display.clearDisplay();
-      pthread_mutex_lock(&disp_info_lock);
+    if (tick || num_bars_read) {
       display.invertDisplay(get_invert(opts.invert));
       draw_display(display, disp_info);
-      pthread_mutex_unlock(&disp_info_lock);
       display.display();
     }
 
-    if (timer.finished()) {
+    if (tick) {
       display.reset_offset();
-      if (disp_info.status.get_state() == MPD_STATE_PLAY && fifo_fd < 0) {
-	// delay cava start by 2 seconds (for Moode)
-	// https://github.com/antiprism/mpd_oled/issues/67
+      const bool playing = disp_info.status().get_state() == MPD_STATE_PLAY;
+      if (use_analyser && playing && !analyser.is_open()) {
+        // MPD creates the FIFO, so keep trying until it exists
+        if (analyser.open(opts.cava_source, opts.bars, opts.framerate))
+          fifo_fd = analyser.get_fd();
+        else if (errno != ENOENT) {
+          opts.warning("could not open audio FIFO, using cava: " +
+                       string(strerror(errno)));
+          use_analyser = false;
+        }
+      }
+      if (!use_analyser && playing && fifo_file == nullptr) {
+        // delay cava start by 2 seconds (for Moode)
+        // https://github.com/antiprism/mpd_oled/issues/67
         usleep(2 * 1000000);
         opts.print_status_or_exit(start_cava(&fifo_file, opts));
         fifo_fd = fileno(fifo_file);
       }
-
-      timer.set_timer(update_sec); // Reset the timer
     }
   }
 
@@ -627,11 +1021,24 @@ int main(int argc, char **argv)
   opts.process_command_line(argc, argv);
 
   // Set up the OLED doisplay
-  if (!init_display(display, opts.oled, opts.i2c_addr, opts.i2c_bus,
-                    opts.reset_gpio, opts.spi_dc_gpio, opts.spi_cs,
-                    opts.rotate180))
+  if (opts.virtual_hz) {
+    if (!init_virtual_display(display, opts.oled, opts.virtual_hz,
+                              opts.virtual_pbm, opts.rotate180))
+      opts.error("could not initialise virtual OLED");
+  }
+  else if (!init_display(display, opts.oled, opts.i2c_addr, opts.i2c_bus,
+                         opts.reset_gpio, opts.spi_dc_gpio, opts.spi_cs,
+                         opts.rotate180))
     opts.error("could not initialise OLED");
 
+  // Only the widgets that change are drawn, and only their boxes are
+  // compared with the last frame sent
+  display.setDamageTracking(true);
+
+  // Send frames to the OLED while the next one is being drawn
+  if (!display.startFlushThread())
+    opts.warning("could not start OLED flush thread, sending frames directly");
+
   init_signals();
   atexit(cleanup);
   int loop_ret = start_idle_loop(display, opts);
@@ -0,0 +1,240 @@
+/*
+   Copyright (c) 2026, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+// Benchmark of drawing in the page format of the OLED against drawing in
+// a row canvas that is converted to pages by display(). Frames are sent
+// to a virtual OLED, and the pictures from the two modes are compared.
+// The volume slider widget is also timed drawn directly and from sprites.
+//
+// Build with "make oled_bench", run as "oled_bench [frames]"
+
+#include "ArduiPi_OLED.h"
+#include "ArduiPi_OLED_lib.h"
+#include "OLED_Format.h"
+#include "display.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now_secs()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print(ArduiPi_OLED &display, const char *str)
+{
+  for (const char *c = str; *c; c++)
+    display.write((uint8_t)*c);
+}
+
+// A frame similar to the mpd_oled screens: text, bars and a few shapes
+static void draw_scene(ArduiPi_OLED &display, int frame)
+{
+  const int W = display.width();
+  const int H = display.height();
+  display.clearDisplay();
+
+  display.setTextColor(WHITE);
+  display.setTextSize(1);
+  display.setCursor(frame % 16, 0);
+  print(display, "Artist - Title of the song");
+  display.setCursor(0, H - 8);
+  print(display, "1:23/4:56  44.1kHz");
+
+  for (int i = 0; i < 16; i++) {
+    int h = 1 + (i * 7 + frame * 3) % (H / 2);
+    display.fillRect(i * 4, H - 10 - h, 3, h, WHITE);
+  }
+
+  display.drawRect(70, 10, W - 72, 8, WHITE);
+  display.fillRect(72, 12, (frame * 3) % (W - 76), 4, WHITE);
+  display.drawCircle(96, H / 2 + 4, H / 5, WHITE);
+  display.drawLine(70, H - 11, W - 1, frame % (H / 2), WHITE);
+}
+
+struct bench_result {
+  double draw_us;    // drawing, per frame
+  double display_us; // display(), per frame, with any conversion
+};
+
+static bench_result run_mode(ArduiPi_OLED &display, int frames)
+{
+  bench_result res = {0, 0};
+  for (int f = 0; f < frames; f++) {
+    double start = now_secs();
+    draw_scene(display, f);
+    double drawn = now_secs();
+    display.display();
+    double shown = now_secs();
+    res.draw_us += drawn - start;
+    res.display_us += shown - drawn;
+  }
+  res.draw_us *= 1e6 / frames;
+  res.display_us *= 1e6 / frames;
+  return res;
+}
+
+// Check a frame looks the same in page and canvas modes
+static bool same_picture(ArduiPi_OLED &display, OLED_Virtual_Transport *virt,
+                         int frame)
+{
+  const int W = display.width();
+  const int H = display.height();
+  bool *pix = new bool[W * H];
+  display.setCanvasMode(false);
+  draw_scene(display, frame);
+  display.display();
+  for (int i = 0; i < W * H; i++)
+    pix[i] = virt->getPixel(i % W, i / W);
+
+  display.setCanvasMode(true);
+  draw_scene(display, frame);
+  display.display();
+  bool same = true;
+  for (int i = 0; i < W * H; i++)
+    same = same && (pix[i] == virt->getPixel(i % W, i / W));
+
+  delete[] pix;
+  return same;
+}
+
+static void bench_transpose(int width, int height, int reps)
+{
+  uint8_t *rows = new uint8_t[width * height / 8];
+  uint8_t *pages = new uint8_t[width * height / 8];
+  for (int i = 0; i < width * height / 8; i++)
+    rows[i] = rand();
+
+  double start = now_secs();
+  for (int r = 0; r < reps; r++)
+    for (int page = 0; page < height / 8; page++)
+      OLED_Rows_To_Page(rows + page * width, pages + page * width, width);
+  double secs = now_secs() - start;
+  printf("  convert whole canvas:   %8.3f us\n", 1e6 * secs / reps);
+
+  delete[] rows;
+  delete[] pages;
+}
+
+// The volume slider of the mpd_oled screens, with the volume changing
+// each frame
+static void draw_volume(ArduiPi_OLED &display, int frame)
+{
+  display.fillRect(98, 1, 11, 6, BLACK);
+  draw_triangle_slider(display, 98, 1, 11, 6, frame % 101);
+}
+
+static double time_volume(ArduiPi_OLED &display, int frames)
+{
+  double start = now_secs();
+  for (int f = 0; f < frames; f++)
+    draw_volume(display, f);
+  return 1e6 * (now_secs() - start) / frames;
+}
+
+// Check the volume slider looks the same drawn directly and from sprites
+static bool same_volume(ArduiPi_OLED &display, OLED_Virtual_Transport *virt)
+{
+  const int W = display.width();
+  const int H = display.height();
+  bool *pix = new bool[W * H];
+  bool same = true;
+  for (int f = 0; f < 101; f++) {
+    widget_sprites().set_max_sprites(0);
+    display.clearDisplay();
+    draw_volume(display, f);
+    display.display();
+    for (int i = 0; i < W * H; i++)
+      pix[i] = virt->getPixel(i % W, i / W);
+
+    widget_sprites().set_max_sprites(256);
+    display.clearDisplay();
+    draw_volume(display, f);
+    display.display();
+    for (int i = 0; i < W * H; i++)
+      same = same && (pix[i] == virt->getPixel(i % W, i / W));
+  }
+  delete[] pix;
+  return same;
+}
+
+int main(int argc, char *argv[])
+{
+  int frames = (argc > 1) ? atoi(argv[1]) : 20000;
+  if (frames < 1) {
+    fprintf(stderr, "usage: oled_bench [frames]\n");
+    return 1;
+  }
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  const char *kernel = "NEON";
+#elif defined(__SSE2__)
+  const char *kernel = "SSE2";
+#else
+  const char *kernel = "scalar";
+#endif
+  printf("%d frames, %s transpose\n", frames, kernel);
+
+  const int types[] = {OLED_ADAFRUIT_SPI_128x64, OLED_ADAFRUIT_SPI_128x32};
+  for (int type : types) {
+    ArduiPi_OLED display;
+    if (!display.init_virtual(type, 8000000)) {
+      fprintf(stderr, "could not initialise virtual OLED\n");
+      return 1;
+    }
+    display.begin();
+    OLED_Virtual_Transport *virt =
+        dynamic_cast<OLED_Virtual_Transport *>(display.getTransport());
+
+    printf("%s\n", oled_type_str[type]);
+    display.setCanvasMode(false);
+    bench_result page = run_mode(display, frames);
+    display.setCanvasMode(true);
+    bench_result canvas = run_mode(display, frames);
+    printf("  page format:   draw %8.3f us, display %8.3f us\n", page.draw_us,
+           page.display_us);
+    printf("  canvas:        draw %8.3f us, display %8.3f us\n",
+           canvas.draw_us, canvas.display_us);
+    bench_transpose(display.width(), display.height(), frames);
+    printf("  pictures %s\n",
+           same_picture(display, virt, frames) ? "match" : "DIFFER");
+
+    display.setCanvasMode(false);
+    widget_sprites().set_max_sprites(0);
+    double direct_us = time_volume(display, frames);
+    widget_sprites().set_max_sprites(256);
+    double sprite_us = time_volume(display, frames);
+    printf("  volume slider: direct %8.3f us, sprites %8.3f us (%d held)\n",
+           direct_us, sprite_us, (int)widget_sprites().size());
+    printf("  volume pictures %s\n",
+           same_volume(display, virt) ? "match" : "DIFFER");
+
+    display.close();
+  }
+
+  return 0;
+}
@@ -0,0 +1,255 @@
+/*
+   Copyright (c) 2026, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+#include "spectrum.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+using std::string;
+using std::vector;
+
+namespace {
+const int SAMPLE_RATE = 44100; // MPD FIFO format 44100:16:2
+const int FRAME_BYTES = 4;     // 16 bit stereo
+const int FFT_SIZE = 2048;     // 46ms at 44100Hz, 21.5Hz bins
+const float FREQ_LOW = 50;     // range of frequencies shown in the bars
+const float FREQ_HIGH = 10000;
+const size_t READ_BYTES = 4096 * FRAME_BYTES;
+} // namespace
+
+spect_analyser::spect_analyser()
+    : fd(-1), rate(SAMPLE_RATE), fft_sz(FFT_SIZE), samples_pos(0),
+      pcm_part(0), gain(4), gain_up(1), gain_down(1), gravity(0)
+{
+}
+
+bool spect_analyser::open(const string &fifo_path, int bars, int framerate)
+{
+  close();
+  // Open read/write so the FIFO never reports end of file while MPD has
+  // no writer open, e.g. when paused, and select() only wakes for audio
+  fd = ::open(fifo_path.c_str(), O_RDWR | O_NONBLOCK);
+  if (fd < 0)
+    return false;
+
+  samples.assign(fft_sz, 0.0f);
+  samples_pos = 0;
+  pcm.resize(READ_BYTES);
+  pcm_part = 0;
+  init_fft();
+  power.resize(fft_sz / 2 + 1);
+  init_bands(bars);
+
+  levels.assign(bars, 0.0f);
+  fall_vel.assign(bars, 0.0f);
+  // Gain falls quickly when bars overshoot, and rises slowly otherwise
+  gain_down = pow(0.3, 1.0 / framerate);
+  gain_up = pow(1.1, 1.0 / framerate);
+  // A full height bar falls to zero in half a second
+  gravity = 8.0 / ((double)framerate * framerate);
+  return true;
+}
+
+void spect_analyser::close()
+{
+  if (fd >= 0)
+    ::close(fd);
+  fd = -1;
+}
+
+void spect_analyser::init_fft()
+{
+  const int n = fft_sz / 2; // real FFT calculated with a complex FFT
+  window.resize(fft_sz);
+  for (int i = 0; i < fft_sz; i++)
+    window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / (fft_sz - 1));
+
+  re.resize(n);
+  im.resize(n);
+  tw_re.resize(n / 2);
+  tw_im.resize(n / 2);
+  for (int i = 0; i < n / 2; i++) {
+    tw_re[i] = cos(2 * M_PI * i / n);
+    tw_im[i] = -sin(2 * M_PI * i / n);
+  }
+  sp_re.resize(n);
+  sp_im.resize(n);
+  for (int i = 0; i < n; i++) {
+    sp_re[i] = cos(2 * M_PI * i / fft_sz);
+    sp_im[i] = -sin(2 * M_PI * i / fft_sz);
+  }
+
+  int bits = 0;
+  while ((1 << bits) < n)
+    bits++;
+  bit_rev.resize(n);
+  for (int i = 0; i < n; i++) {
+    unsigned rev = 0;
+    for (int b = 0; b < bits; b++)
+      rev |= ((i >> b) & 1) << (bits - 1 - b);
+    bit_rev[i] = rev;
+  }
+}
+
+void spect_analyser::init_bands(int bars)
+{
+  // Log spaced bands, each containing at least one FFT bin
+  band_bins.resize(bars + 1);
+  for (int i = 0; i <= bars; i++) {
+    double freq = FREQ_LOW * pow(FREQ_HIGH / FREQ_LOW, (double)i / bars);
+    band_bins[i] = (int)(freq * fft_sz / rate + 0.5);
+    if (i > 0 && band_bins[i] <= band_bins[i - 1])
+      band_bins[i] = band_bins[i - 1] + 1;
+  }
+}
+
+int spect_analyser::read()
+{
+  int cnt = 0;
+  while (true) {
+    ssize_t ret = ::read(fd, &pcm[pcm_part], pcm.size() - pcm_part);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      return -1;
+    }
+    if (ret == 0)
+      break;
+
+    const size_t len = pcm_part + ret;
+    const size_t frames = len / FRAME_BYTES;
+    const unsigned mask = fft_sz - 1;
+    for (size_t i = 0; i < frames; i++) {
+      const unsigned char *p = &pcm[i * FRAME_BYTES];
+      int16_t left = (int16_t)(p[0] | (p[1] << 8));
+      int16_t right = (int16_t)(p[2] | (p[3] << 8));
+      samples[samples_pos] = (left + right) * (1.0f / 65536);
+      samples_pos = (samples_pos + 1) & mask;
+    }
+    pcm_part = len - frames * FRAME_BYTES;
+    memmove(&pcm[0], &pcm[frames * FRAME_BYTES], pcm_part);
+    cnt += frames;
+  }
+  return cnt;
+}
+
+// Power spectrum of the windowed samples, bins 0 to fft_sz/2. The real
+// input is packed into a complex FFT of half the size, which is then
+// split into the spectrum of the even and odd samples.
+void spect_analyser::fft_power()
+{
+  const int n = fft_sz / 2;
+  const unsigned mask = fft_sz - 1;
+  for (int i = 0; i < n; i++) {
+    const unsigned j = bit_rev[i];
+    const int idx = 2 * i; // oldest sample first
+    re[j] = samples[(samples_pos + idx) & mask] * window[idx];
+    im[j] = samples[(samples_pos + idx + 1) & mask] * window[idx + 1];
+  }
+
+  for (int len = 2; len <= n; len *= 2) {
+    const int half = len / 2;
+    const int step = n / len;
+    for (int start = 0; start < n; start += len) {
+      for (int k = 0; k < half; k++) {
+        const float wr = tw_re[k * step];
+        const float wi = tw_im[k * step];
+        const int a = start + k;
+        const int b = a + half;
+        const float tr = re[b] * wr - im[b] * wi;
+        const float ti = re[b] * wi + im[b] * wr;
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+      }
+    }
+  }
+
+  for (int k = 0; k <= n; k++) {
+    const int k1 = (k == n) ? 0 : k;
+    const int k2 = (k == 0) ? 0 : n - k;
+    // even = (Z[k] + conj(Z[n-k])) / 2, odd = (Z[k] - conj(Z[n-k])) / 2i
+    const float ev_re = 0.5f * (re[k1] + re[k2]);
+    const float ev_im = 0.5f * (im[k1] - im[k2]);
+    const float od_re = 0.5f * (im[k1] + im[k2]);
+    const float od_im = -0.5f * (re[k1] - re[k2]);
+    const float wr = (k == n) ? -1.0f : sp_re[k];
+    const float wi = (k == n) ? 0.0f : sp_im[k];
+    const float x_re = ev_re + od_re * wr - od_im * wi;
+    const float x_im = ev_im + od_re * wi + od_im * wr;
+    power[k] = x_re * x_re + x_im * x_im;
+  }
+}
+
+void spect_analyser::update(spect_graph &spect)
+{
+  fft_power();
+
+  // A full scale sine wave has a magnitude of fft_sz/4 with a Hann window.
+  // Summing the power in log spaced bands gives pink noise, and so most
+  // music, bars of similar heights.
+  const float scale = 4.0f / fft_sz;
+  const int bars = std::min(levels.size(), spect.heights.size());
+  bool overshoot = false;
+  float max_mag = 0;
+  for (int i = 0; i < bars; i++) {
+    float band_power = 0;
+    for (int k = band_bins[i]; k < band_bins[i + 1]; k++)
+      band_power += power[k];
+    const float mag = sqrtf(band_power) * scale;
+    max_mag = std::max(max_mag, mag);
+
+    float target = mag * gain;
+    if (target > 1) {
+      overshoot = true;
+      target = 1;
+    }
+
+    // Rise immediately, fall with gravity
+    if (target >= levels[i]) {
+      levels[i] = target;
+      fall_vel[i] = 0;
+    }
+    else {
+      fall_vel[i] += gravity;
+      levels[i] = std::max(target, levels[i] - fall_vel[i]);
+    }
+    spect.heights[i] = (unsigned char)(levels[i] * 255 + 0.5f);
+  }
+
+  // Adjust the gain so the loudest bars are near full height, but do not
+  // raise it while the audio is near silent
+  if (overshoot)
+    gain *= gain_down;
+  else if (max_mag > 1e-4f)
+    gain = std::min(gain * gain_up, 1e4f);
+}
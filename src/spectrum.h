@@ -0,0 +1,86 @@
+/*
+   Copyright (c) 2026, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include "display_info.h"
+
+#include <string>
+#include <vector>
+
+// Spectrum analyser reading PCM audio directly from an MPD FIFO output in
+// the format 44100:16:2 (see scripts/mpd_oled_fifo.conf). Bar heights are
+// in the range 0-255, as with the cava 8 bit raw output.
+class spect_analyser {
+private:
+  int fd;
+  int rate;                       // sample rate
+  int fft_sz;                     // samples analysed, power of 2
+  std::vector<float> samples;     // ring buffer of mono samples
+  unsigned samples_pos;           // next write position in samples
+  std::vector<unsigned char> pcm; // read buffer, may start with part frame
+  size_t pcm_part;                // bytes of partial frame at start of pcm
+
+  std::vector<float> window;       // Hann window
+  std::vector<float> re, im;       // complex FFT of size fft_sz/2
+  std::vector<float> tw_re, tw_im; // twiddles for the complex FFT
+  std::vector<float> sp_re, sp_im; // twiddles to split the real FFT
+  std::vector<unsigned> bit_rev;   // bit reversal permutation
+  std::vector<float> power;        // power in each FFT bin
+  std::vector<int> band_bins;      // first FFT bin of each band, and end
+
+  std::vector<float> levels;   // bar levels, 0.0 - 1.0
+  std::vector<float> fall_vel; // bar fall speeds
+  float gain;                  // auto gain, scales band magnitude to level
+  float gain_up;               // per frame gain change with no overshoot
+  float gain_down;             // per frame gain change with overshoot
+  float gravity;               // per frame increase in fall speed
+
+  void init_fft();
+  void init_bands(int bars);
+  void fft_power();
+
+public:
+  spect_analyser();
+  ~spect_analyser() { close(); }
+  spect_analyser(const spect_analyser &) = delete;
+  spect_analyser &operator=(const spect_analyser &) = delete;
+
+  // Open the FIFO and set up the analysis for bars updated at framerate.
+  // Returns false, with errno set, if the FIFO could not be opened.
+  bool open(const std::string &fifo_path, int bars, int framerate);
+  void close();
+  bool is_open() const { return fd >= 0; }
+  int get_fd() const { return fd; }
+
+  // Read all the audio available without blocking. Returns the number of
+  // samples read, or -1 on error.
+  int read();
+
+  // Analyse the most recent audio and set the bar heights
+  void update(spect_graph &spect);
+};
+
+#endif // SPECTRUM_H
@@ -27,7 +27,7 @@
 */
 
 #include "status.h"
-#include "iconv_wrap.h"
+#include "utils.h"
 
 #include <mpd/client.h>
 
@@ -36,146 +36,271 @@
 
 #include <arpa/inet.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
+#include <sys/inotify.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <string>
 
 using std::string;
 
-namespace {
-const iconvpp::converter conv("ASCII//TRANSLIT", "UTF-8", true);
+bool net_monitor::open()
+{
+  close();
+  fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+              NETLINK_ROUTE);
+  if (fd < 0)
+    return false;
+
+  sockaddr_nl addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+  if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+    int err = errno;
+    close();
+    errno = err;
+    return false;
+  }
+
+  // The interfaces are dumped first, then their addresses
+  request_dump(RTM_GETLINK);
+  return true;
 }
 
-static string to_ascii(string str)
+void net_monitor::close()
 {
-  string ascii;
-  try {
-    conv.convert(str, ascii);
-  }
-  catch (...) {
+  if (fd >= 0)
+    ::close(fd);
+  fd = -1;
+  dump = 0;
+  ifaces.clear();
+}
+
+void net_monitor::request_dump(int type)
+{
+  struct {
+    nlmsghdr nh;
+    rtgenmsg gen;
+  } req;
+  memset(&req, 0, sizeof(req));
+  req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(rtgenmsg));
+  req.nh.nlmsg_type = type;
+  req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req.nh.nlmsg_seq = ++seq;
+  req.gen.rtgen_family = (type == RTM_GETADDR) ? AF_INET : AF_UNSPEC;
+
+  if (type == RTM_GETLINK) {
+    ifaces.clear();
+    resync = false;
   }
-  return ascii;
+  dump = (send(fd, &req, req.nh.nlmsg_len, 0) < 0) ? 0 : type;
+  if (!dump)
+    resync = true; // try again on the next update
 }
 
-// https://stackoverflow.com/questions/1570511/c-code-to-get-the-ip-address
-string get_ip_address(const char *if_str)
+// Whether /sys/class/net/if_name/entry exists
+static bool sys_net_has(const string &if_name, const char *entry)
 {
-  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  return access(("/sys/class/net/" + if_name + "/" + entry).c_str(), F_OK) ==
+         0;
+}
 
-  struct ifreq ifr;
-  ifr.ifr_addr.sa_family = AF_INET;
-  snprintf(ifr.ifr_name, IFNAMSIZ, "%s", if_str);
-  ioctl(fd, SIOCGIFADDR, &ifr);
+void net_monitor::link_msg(const nlmsghdr *nh)
+{
+  const ifinfomsg *ifi = (const ifinfomsg *)NLMSG_DATA(nh);
+  if (nh->nlmsg_type == RTM_DELLINK) {
+    ifaces.erase(ifi->ifi_index);
+    return;
+  }
 
-  string ip_str = inet_ntoa(((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr);
-  close(fd);
-  return ip_str;
+  iface &ifc = ifaces[ifi->ifi_index];
+  ifc.flags = ifi->ifi_flags;
+  int len = IFLA_PAYLOAD(nh);
+  for (const rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len);
+       rta = RTA_NEXT(rta, len)) {
+    if (rta->rta_type != IFLA_IFNAME)
+      continue;
+    const string name = (const char *)RTA_DATA(rta);
+    if (name != ifc.name) { // new, or renamed
+      ifc.name = name;
+      ifc.physical = sys_net_has(name, "device");
+      ifc.wireless =
+          sys_net_has(name, "wireless") || sys_net_has(name, "phy80211");
+    }
+  }
 }
 
-bool eth_connection(char *ifname)
+void net_monitor::addr_msg(const nlmsghdr *nh)
 {
-  struct ifreq ifr;
+  const ifaddrmsg *ifa = (const ifaddrmsg *)NLMSG_DATA(nh);
+  auto it = ifaces.find(ifa->ifa_index);
+  if (ifa->ifa_family != AF_INET || it == ifaces.end())
+    return;
 
-  memset(&ifr, 0, sizeof(ifr));
-  strcpy(ifr.ifr_name, ifname);
+  // The local address, or for most interfaces the same address
+  char addr[INET_ADDRSTRLEN] = "";
+  int len = IFA_PAYLOAD(nh);
+  for (const rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, len);
+       rta = RTA_NEXT(rta, len))
+    if (rta->rta_type == IFA_LOCAL ||
+        (rta->rta_type == IFA_ADDRESS && addr[0] == '\0'))
+      inet_ntop(AF_INET, RTA_DATA(rta), addr, sizeof(addr));
+
+  if (addr[0] == '\0')
+    return;
 
-  int found = false;
-  int dummy_fd = socket(AF_INET, SOCK_DGRAM, 0);
-  if (ioctl(dummy_fd, SIOCGIFFLAGS, &ifr) != -1)
-    found = (ifr.ifr_flags & (IFF_UP | IFF_RUNNING)) == (IFF_UP | IFF_RUNNING);
-  close(dummy_fd);
-  return found;
+  // All the addresses are kept, so another is shown when one is removed
+  std::vector<string> &addrs = it->second.ip_addrs;
+  auto pos = std::find(addrs.begin(), addrs.end(), addr);
+  if (nh->nlmsg_type == RTM_NEWADDR && pos == addrs.end())
+    addrs.push_back(addr);
+  else if (nh->nlmsg_type == RTM_DELADDR && pos != addrs.end())
+    addrs.erase(pos);
 }
 
-// Get network connection values
-bool connection_info::init()
+void net_monitor::read_events()
 {
-  type = TYPE_UNKNOWN;
-  if_name.clear();
-  ip_addr.clear();
-  link = 0;
+  alignas(nlmsghdr) char buf[8192];
+  ssize_t ret;
+  while ((ret = recv(fd, buf, sizeof(buf), 0)) > 0) {
+    int len = ret;
+    for (const nlmsghdr *nh = (const nlmsghdr *)buf; NLMSG_OK(nh, len);
+         nh = NLMSG_NEXT(nh, len)) {
+      switch (nh->nlmsg_type) {
+      case NLMSG_DONE:
+      case NLMSG_ERROR:
+        if (dump && nh->nlmsg_seq == seq) {
+          if (dump == RTM_GETLINK && !resync)
+            request_dump(RTM_GETADDR);
+          else
+            dump = 0;
+        }
+        break;
+      case RTM_NEWLINK:
+      case RTM_DELLINK:
+        link_msg(nh);
+        break;
+      case RTM_NEWADDR:
+      case RTM_DELADDR:
+        addr_msg(nh);
+        break;
+      }
+    }
+  }
+  if (ret < 0 && errno == ENOBUFS) // events lost
+    resync = true;
+  if (resync && !dump)
+    request_dump(RTM_GETLINK);
+}
 
-  // Check for ethernet
-  const char *digits = "0123456789";
-  char ifname[] = "ethN";
-  for (int i = 0; i < 4; i++) {
-    ifname[3] = digits[i];
-    if (eth_connection(ifname)) {
-      type = TYPE_ETH;
-      if_name = ifname;
+// Link quality of if_name in /proc/net/wireless, 0 if not listed
+static int read_wifi_link(const string &if_name)
+{
+  int link = 0;
+  FILE *fproc = fopen("/proc/net/wireless", "r");
+  if (fproc == NULL)
+    return link;
+
+  // Lines of interest are "  name: status link. level. noise. ..."
+  char line[256];
+  while (fgets(line, sizeof(line), fproc)) {
+    const char *name = line + strspn(line, " ");
+    const char *colon = strchr(name, ':');
+    if (colon && (size_t)(colon - name) == if_name.size() &&
+        strncmp(name, if_name.c_str(), if_name.size()) == 0) {
+      char *end;
+      strtol(colon + 1, &end, 16); // status
+      link = strtol(end, nullptr, 10);
       break;
     }
   }
+  fclose(fproc);
+  return link;
+}
 
-  // Check for wifi
-  if (type == TYPE_UNKNOWN) {
-    FILE *fproc = fopen("/proc/net/wireless", "r");
-    if (fproc != NULL) {
-      char buf[128];
-      for (int i = 0; i < 30; i++) { // Link is in position 30
-        if (fscanf(fproc, "%s", buf) == EOF) {
-          strcpy(buf, "0");
-          break;
-        }
-        if (i == 27) { // the interface name
-          if_name = buf;
-          if (buf[0] != '\0') // remove the trailing ':'
-            if_name.resize(if_name.size() - 1);
-        }
-      }
-      fclose(fproc);
-
-      if (if_name.size()) {
-        type = TYPE_WIFI;
-        link = atoi(buf);
-      }
+void net_monitor::update(connection_info &conn)
+{
+  if (fd >= 0)
+    read_events();
+
+  const unsigned up_running = IFF_UP | IFF_RUNNING;
+  const iface *wired = nullptr;
+  const iface *wifi = nullptr;
+  for (const auto &kv : ifaces) {
+    const iface &ifc = kv.second;
+    if (!ifc.physical || (ifc.flags & IFF_LOOPBACK) || !(ifc.flags & IFF_UP))
+      continue;
+    if (!ifc.wireless) {
+      if (!wired && (ifc.flags & up_running) == up_running)
+        wired = &ifc;
     }
+    else if (!wifi || (!(wifi->flags & IFF_RUNNING) &&
+                       (ifc.flags & IFF_RUNNING)))
+      wifi = &ifc;
   }
 
-  if (type != TYPE_UNKNOWN)
-    ip_addr = get_ip_address(if_name.c_str());
-
-  return (type != TYPE_UNKNOWN);
+  conn = connection_info();
+  const iface *shown = wired ? wired : wifi;
+  link_shown = (shown != nullptr && shown == wifi);
+  if (shown == nullptr)
+    return;
+  conn.type = wired ? connection_info::TYPE_ETH : connection_info::TYPE_WIFI;
+  conn.if_name = shown->name;
+  if (!shown->ip_addrs.empty())
+    conn.ip_addr = shown->ip_addrs.front();
+  if (shown == wifi) {
+    if (link_if != wifi->name || link_timer.finished()) {
+      link_if = wifi->name;
+      link = read_wifi_link(link_if);
+      link_timer.set_timer(link_secs);
+    }
+    conn.link = link;
+  }
 }
 
-/// Get Volumio status file as string
-string get_volumio_status()
-{
-  char url[] = "http://localhost:3000/api/v1/getstate";
+/// Volumio status API, with the connection kept open between requests
+struct volumio_api {
   HttpRequest req;
-  return (req.set_url(url) == 0) ? req.get() : string();
-}
+  string status; // last status read, reusing the memory
+
+  volumio_api()
+  {
+    req.set_url("http://localhost:3000/api/v1/getstate");
+    req.set_timeouts(500, 1000);
+  }
+};
 
 /// Get kilobit rate of song from MPD
 int get_mpd_kbitrate(struct mpd_connection *conn)
 {
-  mpd_command_list_begin(conn, true);
-  mpd_send_status(conn);
-  mpd_command_list_end(conn);
-
   int kbitrate = 0;
-  struct mpd_status *status = mpd_recv_status(conn);
+  struct mpd_status *status = mpd_run_status(conn);
   if (status != NULL) {
     int stat = mpd_status_get_state(status);
     if (stat == MPD_STATE_PLAY || stat == MPD_STATE_PAUSE)
       kbitrate = mpd_status_get_kbit_rate(status);
     mpd_status_free(status);
   }
-
-  mpd_response_finish(conn);
   return kbitrate;
 }
 
-void mpd_info::set_vals_volumio(struct mpd_connection *conn)
+/// Read the Volumio status requested by init(), and set the values from it
+void mpd_info::set_vals_volumio()
 {
-  string volumio_status = get_volumio_status();
+  volumio->req.finish_get(volumio->status);
+  const string &volumio_status = volumio->status;
   Hjson::Value obj =
       Hjson::Unmarshal(volumio_status.c_str(), volumio_status.size());
 
@@ -212,12 +337,13 @@ void mpd_info::set_vals_volumio(struct mpd_connection *conn)
                  : string();
   }
   else {
+    int mpd_kbitrate = kbitrate; // from MPD, not Volumio
     init_vals();
+    kbitrate = mpd_kbitrate;
   }
-
-  kbitrate = get_mpd_kbitrate(conn);
 }
 
+/// Get the values of a song tag as ASCII, separated by "; "
 static string get_tag(const struct mpd_song *song, enum mpd_tag_type type)
 {
   string tag_vals;
@@ -231,7 +357,256 @@ static string get_tag(const struct mpd_song *song, enum mpd_tag_type type)
   return to_ascii(tag_vals);
 }
 
-mpd_info::mpd_info() { init_vals(); }
+namespace {
+// libmpdclient connects without blocking, and gives up after the timeout.
+// The same timeout applies to each command.
+const unsigned MPD_TIMEOUT_MS = 3000;
+// Delays between failed connection attempts
+const double MPD_RETRY_MIN_SECS = 0.5;
+const double MPD_RETRY_MAX_SECS = 30.0;
+} // namespace
+
+void mpd_client::set_server(const string &hst, unsigned prt,
+                            const string &pass)
+{
+  close();
+  host = hst;
+  port = prt;
+  password = pass;
+  retry_secs = 0;
+  retry.set_timer(0.0);
+}
+
+struct mpd_connection *mpd_client::get()
+{
+  if (conn && mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS)
+    close();
+
+  if (!conn) {
+    if (!retry.finished()) // still backing off after a failure
+      return nullptr;
+
+    conn = mpd_connection_new(host.size() ? host.c_str() : NULL, port,
+                              MPD_TIMEOUT_MS);
+    if (mpd_connection_get_error(conn) == MPD_ERROR_SUCCESS &&
+        password.size())
+      mpd_run_password(conn, password.c_str());
+
+    if (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS) {
+      close();
+      retry_secs = std::min(std::max(2 * retry_secs, MPD_RETRY_MIN_SECS),
+                            MPD_RETRY_MAX_SECS);
+      retry.set_timer(retry_secs);
+      return nullptr;
+    }
+
+    connects++;
+    retry_secs = 0;
+    pending = MPD_IDLE_PLAYER | MPD_IDLE_MIXER | MPD_IDLE_OPTIONS; // all new
+  }
+
+  // Leave idle, keeping any changes reported meanwhile
+  if (idling) {
+    idling = false;
+    pending |= mpd_run_noidle(conn);
+    if (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS) {
+      close();
+      return nullptr;
+    }
+  }
+
+  return conn;
+}
+
+void mpd_client::close()
+{
+  if (conn)
+    mpd_connection_free(conn);
+  conn = nullptr;
+  idling = false;
+  pending = MPD_IDLE_PLAYER | MPD_IDLE_MIXER | MPD_IDLE_OPTIONS; // all unknown
+}
+
+void mpd_client::add_query_time(long usecs)
+{
+  queries++;
+  query_usecs += usecs;
+  if (usecs > query_max_usecs) // only the status thread writes
+    query_max_usecs = usecs;
+}
+
+unsigned mpd_client::wait_idle(unsigned mask, double timeout_secs,
+                               const std::vector<int> &other_fds)
+{
+  const int timeout_ms = (timeout_secs < 0) ? -1 : timeout_secs * 1000;
+  // The MPD connection is first, poll() ignores negative fds
+  std::vector<pollfd> pfds(1 + other_fds.size());
+  for (size_t i = 0; i < other_fds.size(); i++) {
+    pfds[i + 1].fd = other_fds[i];
+    pfds[i + 1].events = POLLIN;
+  }
+  if (!idling) {
+    if (!get()) {
+      // no connection, wait before retrying
+      const int retry_ms = retry_secs * 1000;
+      poll(pfds.data() + 1, other_fds.size(),
+           (timeout_ms < 0 || timeout_ms > retry_ms) ? retry_ms : timeout_ms);
+      return 0;
+    }
+    if (pending)
+      return take_pending(); // e.g. reconnected, status not yet read
+    if (!mpd_send_idle_mask(conn, (enum mpd_idle)mask)) {
+      close();
+      return 0;
+    }
+    idling = true;
+  }
+
+  pfds[0].fd = mpd_connection_get_fd(conn);
+  pfds[0].events = POLLIN;
+  if (poll(pfds.data(), pfds.size(), timeout_ms) <= 0 ||
+      !(pfds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+    return 0; // timeout, or other_fds, stay in idle until the next command
+
+  idling = false;
+  unsigned changed = mpd_recv_idle(conn, false) | take_pending();
+  if (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS)
+    close();
+  return changed;
+}
+
+moode_song_file::moode_song_file(const string &path)
+    : path(path), inot_fd(-1), watch(-1), stale(true), exists(false),
+      is_empty(true), has_title(false), state(MPD_STATE_UNKNOWN)
+{
+  const size_t slash = path.rfind('/');
+  dir = (slash == string::npos) ? "." : path.substr(0, slash + 1);
+  name = path.substr(slash + 1);
+  inot_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+moode_song_file::~moode_song_file()
+{
+  if (inot_fd >= 0)
+    ::close(inot_fd);
+}
+
+// Watch the directory rather than the file, as the file may be replaced
+void moode_song_file::set_watch()
+{
+  if (inot_fd < 0 || watch >= 0)
+    return;
+  watch = inotify_add_watch(inot_fd, dir.c_str(),
+                            IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE |
+                                IN_MOVED_FROM);
+  stale = true; // may have changed before the watch
+}
+
+// Read all the events, returns true if any may be for the file
+bool moode_song_file::read_events()
+{
+  bool changed = false;
+  alignas(inotify_event) char buf[4096];
+  ssize_t len;
+  while ((len = read(inot_fd, buf, sizeof(buf))) > 0) {
+    for (char *p = buf; p < buf + len;) {
+      const inotify_event *ev = (const inotify_event *)p;
+      if (ev->mask & IN_IGNORED) // directory gone, watch removed
+        watch = -1;
+      if ((ev->mask & (IN_IGNORED | IN_Q_OVERFLOW)) ||
+          (ev->len && name == ev->name))
+        changed = true;
+      p += sizeof(inotify_event) + ev->len;
+    }
+  }
+  return changed;
+}
+
+// Single pass over the lines, with the value after the first '=' kept
+// for the keys of interest
+void moode_song_file::parse(const char *text, size_t len)
+{
+  is_empty = (len == 0);
+  has_title = false;
+  file.clear();
+  origin.clear();
+  title.clear();
+  state = MPD_STATE_UNKNOWN;
+
+  string artist, album;
+  const char *end = text + len;
+  const char *line = text;
+  while (line < end) {
+    const char *eol = (const char *)memchr(line, '\n', end - line);
+    if (eol == nullptr)
+      eol = end;
+    const char *eq = (const char *)memchr(line, '=', eol - line);
+    if (eq != nullptr && eq + 1 < eol) { // value is not empty
+      const char *val = eq + 1;
+      auto key_is = [line, eq](const char *key) {
+        return (size_t)(eq - line) == strlen(key) &&
+               memcmp(line, key, eq - line) == 0;
+      };
+      auto val_is = [val, eol](const char *word) {
+        return (size_t)(eol - val) == strlen(word) &&
+               memcmp(val, word, eol - val) == 0;
+      };
+
+      if (key_is("file"))
+        file.assign(val, eol);
+      else if (key_is("artist"))
+        artist.assign(val, eol);
+      else if (key_is("album"))
+        album.assign(val, eol);
+      else if (key_is("title")) {
+        title.assign(val, eol);
+        has_title = true;
+      }
+      else if (key_is("state")) {
+        if (val_is("stop"))
+          state = MPD_STATE_STOP;
+        else if (val_is("play"))
+          state = MPD_STATE_PLAY;
+        else if (val_is("pause"))
+          state = MPD_STATE_PAUSE;
+      }
+    }
+    line = eol + 1;
+  }
+
+  if (has_title) {
+    origin = to_ascii((artist == "Radio station") ? album : artist);
+    title = to_ascii(title);
+  }
+}
+
+bool moode_song_file::update()
+{
+  set_watch();
+  if (watch >= 0 && read_events())
+    stale = true;
+  if (!stale && watch >= 0)
+    return false;
+  stale = false;
+
+  // Read the whole file, then parse it
+  exists = false;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return true;
+  string text;
+  char buf[4096];
+  ssize_t len;
+  while ((len = read(fd, buf, sizeof(buf))) > 0)
+    text.append(buf, len);
+  ::close(fd);
+  exists = (len == 0);
+  if (exists)
+    parse(text.data(), text.size());
+  return true;
+}
+
+mpd_info::mpd_info() : client(std::make_shared<mpd_client>()) { init_vals(); }
 
 void mpd_info::init_vals()
 {
@@ -244,19 +619,21 @@ void mpd_info::init_vals()
   kbitrate = 0;
 }
 
-void mpd_info::set_vals(struct mpd_connection *conn)
+void mpd_info::set_vals(struct mpd_connection *conn, unsigned changed)
 {
   if (player.is(Player::Name::volumio))
-    set_vals_volumio(conn);
-  else
-    set_vals_mpd(conn);
+    kbitrate = get_mpd_kbitrate(conn); // the rest is from Volumio
+  else if (changed || state == MPD_STATE_PLAY || // elapsed time changes
+           player.is(Player::Name::moode))       // MPD may not be playing
+    set_vals_mpd(conn, changed & MPD_IDLE_PLAYER);
 }
 
-void mpd_info::set_vals_mpd(struct mpd_connection *conn)
+void mpd_info::set_vals_mpd(struct mpd_connection *conn, bool with_song)
 {
   mpd_command_list_begin(conn, true);
   mpd_send_status(conn);
-  mpd_send_current_song(conn);
+  if (with_song)
+    mpd_send_current_song(conn);
   mpd_command_list_end(conn);
 
   struct mpd_status *status = mpd_recv_status(conn);
@@ -287,11 +664,16 @@ void mpd_info::set_vals_mpd(struct mpd_connection *conn)
   if (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS)
     return;
 
+  if (!with_song) {
+    mpd_response_finish(conn);
+    return;
+  }
+
   mpd_response_next(conn);
 
   struct mpd_song *song;
   if ((song = mpd_recv_song(conn)) != NULL) {
-    title = to_ascii(get_tag(song, MPD_TAG_TITLE));
+    title = get_tag(song, MPD_TAG_TITLE);
 
     // Where does the song come from, just one choice
     enum mpd_tag_type origin_tags[] = {MPD_TAG_ARTIST,       MPD_TAG_NAME,
@@ -299,7 +681,7 @@ void mpd_info::set_vals_mpd(struct mpd_connection *conn)
                                        MPD_TAG_PERFORMER,    MPD_TAG_UNKNOWN};
     int i = 0;
     while (origin_tags[i] != MPD_TAG_UNKNOWN) {
-      origin = to_ascii(get_tag(song, origin_tags[i]));
+      origin = get_tag(song, origin_tags[i]);
       if (origin.size())
         break;
       i++;
@@ -323,89 +705,60 @@ void mpd_info::print_vals() const
   fprintf(stdout, "kbitrate: %d\n", kbitrate);
 }
 
-int mpd_info::init()
+int mpd_info::init(unsigned changed)
 {
-  struct mpd_connection *conn = mpd_connection_new(NULL, 0, 30000);
-  if (mpd_connection_get_error(conn) == MPD_ERROR_SUCCESS)
-    set_vals(conn);
-  int ret = (mpd_connection_get_error(conn) == MPD_ERROR_SUCCESS);
-  mpd_connection_free(conn);
-
+  // The Volumio status is requested first, and read after MPD has been
+  // queried, so that Volumio and MPD prepare their answers together
   if (player.is(Player::Name::volumio)) {
-    string volumio_status = get_volumio_status();
-    Hjson::Value obj =
-        Hjson::Unmarshal(volumio_status.c_str(), volumio_status.size());
+    if (!volumio)
+      volumio = std::make_shared<volumio_api>();
+    volumio->req.start_get();
+  }
 
-    if (obj) {
-      volume = (obj["volume"].type() == Hjson::Value::Type::DOUBLE)
-                   ? static_cast<int>(obj["volume"])
-                   : 0;
-    }
-    else {
-      volume = 0;
-    }
+  // MPD is only taken out of idle when it will be queried, so that
+  // nothing is sent to it while it is idle and not playing
+  changed |= client->take_pending();
+  const bool query = changed || state == MPD_STATE_PLAY ||
+                     player.is(Player::Name::moode) ||
+                     player.is(Player::Name::volumio);
+  struct mpd_connection *conn = query ? client->get() : nullptr;
+  changed |= client->take_pending();
+  if (conn) {
+    Counter query_time;
+    set_vals(conn, changed);
+    client->add_query_time(query_time.usecs());
   }
+  int ret = !query ||
+            (conn && mpd_connection_get_error(conn) == MPD_ERROR_SUCCESS);
+  if (conn && !ret)
+    client->close();
+
+  if (player.is(Player::Name::volumio))
+    set_vals_volumio();
 
   // On Moode, rather than MPD an alternative renderer may be playing audio.
   // If this is the case, detailed song information will not be available,
   // so determine and display the renderer name instead.
   // Also, use for origin and title
   if (player.is(Player::Name::moode)) {
-    state = MPD_STATE_UNKNOWN; // ignore MPD state
-    const char *MOODE_CURRENT_SONG_FILE = "/var/local/www/currentsong.txt";
-    FILE *file = fopen(MOODE_CURRENT_SONG_FILE, "r");
-    if (file != NULL) {
-      int line_sz = 256; // lines of interest will be shorter than this
-      char line[line_sz];
-
-      char file_name[line_sz] = {0};
-      char artist_name[line_sz] = {0};
-      char album_name[line_sz] = {0};
-      char title_name[line_sz] = {0};
-      char buff[line_sz];
-
-      bool has_title = false;
-      bool is_empty = true;
-      while (fgets(line, line_sz - 1, file)) {
-	is_empty = false;
-        if (sscanf(line, "file=%[^\n]", buff) == 1)
-          strcpy(file_name, buff);
-        else if (sscanf(line, "artist=%[^\n]", buff) == 1)
-          strcpy(artist_name, buff);
-        else if (sscanf(line, "album=%[^\n]", buff) == 1)
-          strcpy(album_name, buff);
-        else if (sscanf(line, "title=%[^\n]", buff) == 1) {
-          strcpy(title_name, buff);
-          has_title = true;
-        }
-        else if (sscanf(line, "artist=%[^\n]", buff) == 1)
-          strcpy(artist_name, buff);
-        else if (sscanf(line, "state=%[^\n]", buff) == 1) {
-          if (strcmp(buff, "stop") == 0)
-            state = MPD_STATE_STOP;
-	  else if (strcmp(buff, "play") == 0)
-            state = MPD_STATE_PLAY;
-	  else if (strcmp(buff, "pause") == 0)
-            state = MPD_STATE_PAUSE;
-        }
-      }
-      fclose(file);
+    if (!moode_song)
+      moode_song =
+          std::make_shared<moode_song_file>("/var/local/www/currentsong.txt");
+    moode_song->update();
 
-      if(is_empty)
-        state = MPD_STATE_STOP;
-
-      if(state != MPD_STATE_STOP) {
-        if (!has_title) { // assume this is a renderer
+    state = MPD_STATE_UNKNOWN; // ignore MPD state
+    const moode_song_file &song = *moode_song;
+    if (song.exists) {
+      state = song.is_empty ? MPD_STATE_STOP : song.state;
+      if (state != MPD_STATE_STOP) {
+        if (!song.has_title) { // assume this is a renderer
           init_vals();
-          origin = file_name; // display the renderer as the song origin
+          origin = song.file; // display the renderer as the song origin
           state = MPD_STATE_PLAY;
         }
         else {
-          if (strcmp("Radio station", artist_name) == 0)
-            origin = to_ascii(album_name);
-          else
-            origin = to_ascii(artist_name);
-          title = to_ascii(title_name);
+          origin = song.origin;
+          title = song.title;
         }
       }
     }
@@ -414,6 +767,27 @@ int mpd_info::init()
   return ret;
 }
 
+unsigned mpd_info::wait_for_change(const std::vector<int> &other_fds,
+                                   double max_secs)
+{
+  // The Moode song file wakes the wait when it is rewritten
+  const int moode_fd = moode_song ? moode_song->get_fd() : -1;
+  std::vector<int> fds = other_fds;
+  fds.push_back(moode_fd);
+  double timeout_secs;
+  if (player.is(Player::Name::volumio) ||
+      (player.is(Player::Name::moode) && moode_fd < 0))
+    timeout_secs = 0.3; // status also comes from outside MPD
+  else if (state == MPD_STATE_PLAY)
+    timeout_secs = 1.0; // elapsed time and bitrate are not reported
+  else
+    timeout_secs = -1; // only MPD and other_fds report changes
+  if (max_secs >= 0 && (timeout_secs < 0 || max_secs < timeout_secs))
+    timeout_secs = max_secs;
+
+  return client->wait_idle(IDLE_MASK, timeout_secs, fds);
+}
+
 static string secs_to_time(int secs)
 {
   secs = abs(secs);
@@ -457,9 +831,9 @@ string mpd_info::get_kbitrate_str() const
 
 int mpd_info::get_volume() const { return volume; }
 
-string mpd_info::get_origin() const { return origin; }
+const string &mpd_info::get_origin() const { return origin; }
 
-string mpd_info::get_title() const { return title; }
+const string &mpd_info::get_title() const { return title; }
 
 int mpd_info::get_elapsed_secs() const { return song_elapsed_secs; }
 
@@ -26,10 +26,132 @@
 #include "timer.h"
 
 #include <mpd/client.h>
+#include <atomic>
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
+
+// Persistent connection to MPD, reconnecting with backoff after failures
+class mpd_client {
+private:
+  std::string host; // host name, or UNIX socket path, empty for default
+  unsigned port;    // port, 0 for default
+  std::string password;
+
+  struct mpd_connection *conn;
+  bool idling;      // idle command sent, response not yet received
+  unsigned pending; // changes reported when leaving idle early
+
+  Timer retry;        // do not try to connect again until finished
+  double retry_secs;  // next delay after a failed connection attempt
+  // Statistics, atomic as they may be read from another thread
+  std::atomic<long> connects;    // successful connections
+  std::atomic<long> queries;     // status queries
+  std::atomic<long> query_usecs; // total time in status queries
+  std::atomic<long> query_max_usecs;
+
+public:
+  mpd_client()
+      : port(0), conn(nullptr), idling(false), pending(0), retry_secs(0),
+        connects(0), queries(0), query_usecs(0), query_max_usecs(0)
+  {
+  }
+  ~mpd_client() { close(); }
+  mpd_client(const mpd_client &) = delete;
+  mpd_client &operator=(const mpd_client &) = delete;
+
+  // Set the MPD server, host may be a UNIX socket path, and is the
+  // libmpdclient default (MPD_HOST, or localhost) if empty
+  void set_server(const std::string &hst, unsigned prt,
+                  const std::string &pass);
+
+  // Get the connection, ready for commands, connecting if necessary.
+  // Returns nullptr if there is no connection to MPD.
+  struct mpd_connection *get();
+
+  // Close the connection, e.g. after an error.
+  void close();
+
+  // Get and clear the changes (MPD_IDLE_ flags) reported when idle was
+  // left to send commands.
+  unsigned take_pending()
+  {
+    unsigned ret = pending;
+    pending = 0;
+    return ret;
+  }
+
+  // Wait in idle until MPD reports a change in one of the subsystems in
+  // mask (MPD_IDLE_ flags), or for timeout_secs if it is not negative, or
+  // until one of other_fds is readable (-1 entries are ignored). Returns
+  // the changed subsystems, or 0 if none changed.
+  unsigned wait_idle(unsigned mask, double timeout_secs,
+                     const std::vector<int> &other_fds = {});
+
+  // Record the time taken by a status query
+  void add_query_time(long usecs);
+
+  long get_reconnects() const
+  {
+    long cnt = connects;
+    return cnt ? cnt - 1 : 0;
+  }
+  long get_queries() const { return queries; }
+  double get_mean_query_usecs() const
+  {
+    long cnt = queries;
+    return cnt ? (double)query_usecs / cnt : 0.0;
+  }
+  long get_max_query_usecs() const { return query_max_usecs; }
+};
+
+// The current song file written by Moode, for players other than MPD.
+// The directory is watched with inotify, and the file is read and parsed
+// again only after Moode has rewritten it. If it cannot be watched it is
+// read on every update.
+class moode_song_file {
+private:
+  std::string path;
+  std::string dir;  // directory watched
+  std::string name; // file name in dir
+  int inot_fd;      // inotify instance, or -1
+  int watch;        // watch on dir, or -1
+  bool stale;       // file may have changed since it was parsed
+
+  void set_watch();
+  bool read_events();
+  void parse(const char *text, size_t len);
+
+public:
+  bool exists;   // the file could be read
+  bool is_empty; // the file has no lines
+  bool has_title;
+  std::string file;     // for a renderer, its name
+  std::string origin;   // artist, or station for radio, as ASCII
+  std::string title;    // as ASCII
+  enum mpd_state state; // MPD_STATE_UNKNOWN if not given
+
+  moode_song_file(const std::string &path);
+  ~moode_song_file();
+  moode_song_file(const moode_song_file &) = delete;
+  moode_song_file &operator=(const moode_song_file &) = delete;
+
+  // Read the file again if it may have changed. Returns true if it was
+  // read.
+  bool update();
+  // File descriptor that is readable when the file may have changed,
+  // or -1 if the file is not being watched
+  int get_fd() const { return (watch >= 0) ? inot_fd : -1; }
+};
+
+struct volumio_api;
 
 class mpd_info {
 private:
+  std::shared_ptr<mpd_client> client;
+  std::shared_ptr<moode_song_file> moode_song; // set for the Moode player
+  std::shared_ptr<volumio_api> volumio;        // set for the Volumio player
   Player player;
   int volume;
   std::string origin;
@@ -41,21 +163,38 @@ private:
   Counter last_change;
 
   void init_vals();
-  void set_vals(struct mpd_connection *conn);
-  void set_vals_mpd(struct mpd_connection *conn);
-  void set_vals_volumio(struct mpd_connection *conn);
+  void set_vals(struct mpd_connection *conn, unsigned changed);
+  void set_vals_mpd(struct mpd_connection *conn, bool with_song);
+  void set_vals_volumio();
 
 public:
   enum { SOURCE_MPD = 0, SOURCE_VOLUMIO };
+  // MPD subsystems that affect the status values
+  static const unsigned IDLE_MASK =
+      MPD_IDLE_PLAYER | MPD_IDLE_MIXER | MPD_IDLE_OPTIONS;
 
   mpd_info(); // Constructor
-  int init(); // Initialise with current status values
+  // Update with current status values, changed is a set of MPD_IDLE_
+  // flags for the MPD subsystems that changed since the last update
+  int init(unsigned changed = IDLE_MASK);
+  // Wait until MPD reports a status change, or until the status values
+  // need refreshing anyway, or until one of other_fds is readable, or
+  // for max_secs if it is not negative. Returns the changed MPD_IDLE_
+  // flags.
+  unsigned wait_for_change(const std::vector<int> &other_fds = {},
+                           double max_secs = -1);
   void set_player(Player plyr) { player = plyr; }
+  void set_server(const std::string &host, unsigned port,
+                  const std::string &password)
+  {
+    client->set_server(host, port, password);
+  }
+  const mpd_client &get_client() const { return *client; }
   void print_vals() const;
 
   int get_volume() const;         // Volume: 0 - 100
-  std::string get_origin() const; // Song origin: station, artist, album...
-  std::string get_title() const;  // Song title
+  const std::string &get_origin() const; // Song origin: station, artist...
+  const std::string &get_title() const;  // Song title
   int get_elapsed_secs() const;   // Elapsed time of song in seconds
   int get_total_secs() const;     // Total time of song in seconds
   int get_kbitrate() const;       // KBitrate
@@ -78,11 +217,68 @@ private:
 public:
   enum { TYPE_ETH = 0, TYPE_WIFI, TYPE_UNKNOWN };
 
-  connection_info() : type(TYPE_UNKNOWN) {}
-  bool init();
+  connection_info() : type(TYPE_UNKNOWN), link(0) {}
   bool is_set() const { return type != TYPE_UNKNOWN; }
-  std::string get_if_name() const { return if_name; }
-  std::string get_ip_addr() const { return ip_addr; }
+  const std::string &get_if_name() const { return if_name; }
+  const std::string &get_ip_addr() const { return ip_addr; }
   int get_type() const { return (int)type; }
   int get_link() const { return link; }
+
+  friend class net_monitor;
+};
+
+// Network interfaces, tracked from rtnetlink link and address events.
+// The connection shown is the first physical wired interface that is up
+// and running, otherwise the first wireless interface that is up, with
+// its link quality read from /proc/net/wireless at an interval.
+class net_monitor {
+private:
+  struct iface {
+    std::string name;
+    unsigned flags;      // IFF_ flags
+    bool physical;       // has a device, rather than a bridge, tunnel...
+    bool wireless;
+    // IPv4 addresses, in kernel order, the first is shown
+    std::vector<std::string> ip_addrs;
+  };
+
+  int fd;        // netlink socket, or -1
+  int dump;      // RTM_GET request being dumped, or 0
+  bool resync;   // events were lost, dump everything again
+  unsigned seq;  // sequence number of the last request
+  std::map<int, iface> ifaces; // by interface index
+
+  double link_secs;    // interval between link quality samples
+  Timer link_timer;    // until the next sample
+  std::string link_if; // interface of the last sample
+  int link;            // link quality of the last sample
+  bool link_shown;     // the connection shown is the WiFi
+
+  void request_dump(int type);
+  void read_events();
+  void link_msg(const struct nlmsghdr *nh);
+  void addr_msg(const struct nlmsghdr *nh);
+
+public:
+  net_monitor() : fd(-1), dump(0), resync(false), seq(0), link_secs(5.0),
+                  link(0), link_shown(false)
+  {
+  }
+  ~net_monitor() { close(); }
+  net_monitor(const net_monitor &) = delete;
+  net_monitor &operator=(const net_monitor &) = delete;
+
+  // Subscribe to the events and request the current interfaces. Returns
+  // false, with errno set, if the netlink socket could not be opened.
+  bool open();
+  void close();
+  // File descriptor that is readable when there are events, or -1
+  int get_fd() const { return fd; }
+  // Set the interval between samples of the WiFi link quality
+  void set_link_interval(double secs) { link_secs = secs; }
+  // Process the events received, and set conn to the connection to show
+  void update(connection_info &conn);
+  // Longest time until update() should be called again, to sample the
+  // WiFi link quality, or -1 if only the events need handling
+  double get_wait_secs() const { return link_shown ? link_secs : -1; }
 };
@@ -27,97 +27,164 @@
 */
 
 #include "timer.h"
+#include <errno.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 namespace { // unnamed namespace
 
-long to_long_usecs(timeval tv) { return tv.tv_sec * 1000000 + tv.tv_usec; }
+const long NSECS = 1000000000;
 
-double to_double_secs(timeval tv) { return tv.tv_sec + tv.tv_usec / 1000000.0; }
+static long to_long_usecs(timespec ts)
+{
+  return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+double to_double_secs(timespec ts) { return ts.tv_sec + ts.tv_nsec / 1e9; }
 
-timeval &tv_normalise(timeval &tv)
+timespec &ts_normalise(timespec &ts)
 {
-  long sec = tv.tv_usec / 1000000;
-  tv.tv_usec -= sec * 1000000;
-  if (tv.tv_usec < 0) {
-    tv.tv_usec += 1000000;
-    tv.tv_sec -= 1;
+  long sec = ts.tv_nsec / NSECS;
+  ts.tv_nsec -= sec * NSECS;
+  if (ts.tv_nsec < 0) {
+    ts.tv_nsec += NSECS;
+    sec -= 1;
   }
-  tv.tv_sec += sec;
-  return tv;
+  ts.tv_sec += sec;
+  return ts;
 }
 
-bool operator>(const timeval &t0, const timeval &t1)
+bool operator>(const timespec &t0, const timespec &t1)
 {
   return (t0.tv_sec > t1.tv_sec ||
-          (t0.tv_sec == t1.tv_sec && t0.tv_usec > t1.tv_usec));
+          (t0.tv_sec == t1.tv_sec && t0.tv_nsec > t1.tv_nsec));
 }
 
-timeval operator+(const timeval &t0, const timeval &t1)
+timespec operator+(const timespec &t0, const timespec &t1)
 {
-  timeval ret;
+  timespec ret;
   ret.tv_sec = t0.tv_sec + t1.tv_sec;
-  ret.tv_usec = t0.tv_usec + t1.tv_usec;
-  tv_normalise(ret);
-  return ret;
+  ret.tv_nsec = t0.tv_nsec + t1.tv_nsec;
+  return ts_normalise(ret);
 }
 
-timeval operator-(const timeval &t0, const timeval &t1)
+timespec operator-(const timespec &t0, const timespec &t1)
 {
-  timeval ret;
+  timespec ret;
   ret.tv_sec = t0.tv_sec - t1.tv_sec;
-  ret.tv_usec = t0.tv_usec - t1.tv_usec;
-  return tv_normalise(ret);
+  ret.tv_nsec = t0.tv_nsec - t1.tv_nsec;
+  return ts_normalise(ret);
+}
+
+timespec operator*(const timespec &t, long n)
+{
+  timespec ret;
+  ret.tv_sec = t.tv_sec * n;
+  ret.tv_nsec = 0;
+  long long nsec = (long long)t.tv_nsec * n;
+  ret.tv_sec += nsec / NSECS;
+  ret.tv_nsec = nsec % NSECS;
+  return ret;
+}
+
+timespec to_timespec(double tm)
+{
+  timespec ts;
+  ts.tv_sec = long(tm);
+  ts.tv_nsec = long((tm - ts.tv_sec) * NSECS);
+  return ts;
 }
 
-timeval to_timeval(double tm)
+timespec now()
 {
-  timeval tv;
-  tv.tv_sec = long(tm);
-  tv.tv_usec = long((tm - tv.tv_sec) * 1000000);
-  return tv;
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts;
 }
 
 }; // unnamed namespace
 
-void Timer::set_timer(timeval interval)
+void Timer::set_timer(timespec interval) { end = now() + interval; }
+
+void Timer::set_timer(double interval) { set_timer(to_timespec(interval)); }
+
+void Timer::inc_timer(double inc) { end = end + to_timespec(inc); }
+
+bool Timer::finished() { return now() > end; }
+
+void Timer::sleep_until_finished()
 {
-  timeval tv;
-  gettimeofday(&tv, 0);
-  end = tv + interval;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &end, 0) == EINTR)
+    ;
 }
 
-void Timer::set_timer(double interval) { set_timer(to_timeval(interval)); }
+void Counter::reset() { start = now(); }
+
+long Counter::usecs() const { return to_long_usecs(now() - start); }
 
-void Timer::inc_timer(double inc) { end = end + to_timeval(inc); }
+double Counter::secs() const { return to_double_secs(now() - start); }
 
-bool Timer::finished()
+Ticker::Ticker()
+    : fd(-1), ticks(0), overruns(0), jitter_max(0), jitter_total(0.0)
 {
-  timeval tv;
-  gettimeofday(&tv, 0);
-  return tv > end;
 }
 
-void Timer::sleep_until_finished()
+Ticker::~Ticker() { stop(); }
+
+bool Ticker::start(double period)
 {
-  timeval tv;
-  gettimeofday(&tv, 0);
-  if (end > tv)
-    sleep(to_long_usecs(end - tv));
+  stop();
+  fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  interval = to_timespec(period);
+  next = now() + interval;
+  itimerspec spec;
+  spec.it_interval = interval;
+  spec.it_value = next;
+  if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, 0) < 0) {
+    stop();
+    return false;
+  }
+
+  ticks = 0;
+  overruns = 0;
+  jitter_max = 0;
+  jitter_total = 0.0;
+  return true;
 }
 
-void Counter::reset() { gettimeofday(&start, 0); }
+void Ticker::stop()
+{
+  if (fd >= 0)
+    close(fd);
+  fd = -1;
+}
 
-long Counter::usecs() const
+long Ticker::ack()
 {
-  timeval tv;
-  gettimeofday(&tv, 0);
-  return to_long_usecs(tv - start);
+  uint64_t expired = 0;
+  if (fd < 0 || read(fd, &expired, sizeof(expired)) != sizeof(expired) ||
+      expired == 0)
+    return 0;
+
+  // Lateness is measured from the most recent deadline
+  timespec late = now() - (next + interval * (expired - 1));
+  long late_usecs = (late.tv_sec < 0) ? 0 : to_long_usecs(late);
+  if (late_usecs > jitter_max)
+    jitter_max = late_usecs;
+  jitter_total += late_usecs;
+
+  next = next + interval * expired;
+  ticks += expired;
+  overruns += expired - 1;
+  return expired;
 }
 
-double Counter::secs() const
+double Ticker::get_mean_jitter_usecs() const
 {
-  timeval tv;
-  gettimeofday(&tv, 0);
-  return to_double_secs(tv - start);
+  long handled = ticks - overruns;
+  return handled ? jitter_total / handled : 0.0;
 }
@@ -29,12 +29,12 @@
 #ifndef TIMER_H
 #define TIMER_H
 
-#include <sys/time.h>
+#include <time.h>
 
-/// A subsecond %Timer
+/// A subsecond %Timer, using monotonic time
 class Timer {
 private:
-  timeval end;
+  timespec end;
 
 public:
   /// Constructor
@@ -42,15 +42,15 @@ public:
 
   /// Set the %Timer.
   /**\param interval length of time the %Timer should run. */
-  void set_timer(timeval interval);
+  void set_timer(timespec interval);
 
   /// Set the %Timer.
-  /**\param interval length of time in microseconds that the %Timer
+  /**\param interval length of time in seconds that the %Timer
    * should run. */
   void set_timer(double interval);
 
   /// Increment the %Timer.
-  /**\param inc length of time in microseconds that the %Timer
+  /**\param inc length of time in seconds that the %Timer
    * should be extended. */
   void inc_timer(double inc);
 
@@ -64,12 +64,10 @@ public:
   void sleep_until_finished();
 };
 
-/// A subsecond %Counter
+/// A subsecond %Counter, using monotonic time
 class Counter {
 private:
-  timeval start;
-
-  // int get_time(struct timeval *tp); // wrapper for subsecond current time
+  timespec start;
 
 public:
   /// Constructor
@@ -87,4 +85,60 @@ public:
   double secs() const;
 };
 
+/// A periodic %Ticker, with absolute monotonic deadlines
+/**The deadlines are kept by a timerfd, so they do not drift, and the
+ * file descriptor can be waited on with select() alongside other input. */
+class Ticker {
+private:
+  int fd;
+  timespec interval;
+  timespec next;           // next deadline
+  long ticks;              // deadlines passed
+  long overruns;           // deadlines passed without being handled
+  long jitter_max;         // usecs
+  double jitter_total;     // usecs
+
+public:
+  /// Constructor
+  Ticker();
+
+  /// Destructor
+  ~Ticker();
+
+  Ticker(const Ticker &) = delete;
+  Ticker &operator=(const Ticker &) = delete;
+
+  /// Start the %Ticker.
+  /**\param period length of time in seconds between deadlines.
+   * \return \c true if the %Ticker was started, otherwise \c false. */
+  bool start(double period);
+
+  /// Stop the %Ticker
+  void stop();
+
+  /// Get the file descriptor, readable when a deadline has passed
+  /**\return The file descriptor, or -1 if not started. */
+  int get_fd() const { return fd; }
+
+  /// Handle passed deadlines, without waiting
+  /**\return The number of deadlines passed since last handled. */
+  long ack();
+
+  /// Get the number of deadlines passed
+  /**\return The number of deadlines. */
+  long get_ticks() const { return ticks; }
+
+  /// Get the number of deadlines that passed without being handled
+  /**\return The number of missed deadlines. */
+  long get_overruns() const { return overruns; }
+
+  /// Get the maximum lateness in handling a deadline
+  /**\return The maximum lateness in usecs. */
+  long get_max_jitter_usecs() const { return jitter_max; }
+
+  /// Get the mean lateness in handling a deadline
+  /**\return The mean lateness in usecs. */
+  double get_mean_jitter_usecs() const;
+};
+
 #endif // TIMER_H
@@ -27,9 +27,12 @@
    I/O conversions, etc
 */
 #include "utils.h"
+#include "iconv_wrap.h"
 
 #include <ctype.h>
 #include <limits.h>
+#include <list>
+#include <map>
 #include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -197,6 +200,88 @@ int split_line(char *line, vector<char *> &parts, const char *delims,
   return parts.size();
 }
 
+namespace {
+// Conversions of recent texts, the least recently used are dropped to
+// hold no more than max_texts
+class ascii_cache {
+public:
+  // Conversion held for utf8, or nullptr if there is none
+  const string *find(const string &utf8);
+  void insert(const string &utf8, const string &ascii);
+  void set_max_texts(size_t max);
+
+private:
+  struct text {
+    string ascii;
+    std::list<string>::iterator lru_pos;
+  };
+  size_t max_texts = 32;
+  std::map<string, text> texts;
+  std::list<string> lru; // keys, most recently used first
+};
+
+const string *ascii_cache::find(const string &utf8)
+{
+  auto it = texts.find(utf8);
+  if (it == texts.end())
+    return nullptr;
+  lru.splice(lru.begin(), lru, it->second.lru_pos);
+  return &it->second.ascii;
+}
+
+void ascii_cache::insert(const string &utf8, const string &ascii)
+{
+  if (max_texts == 0)
+    return;
+  if (texts.size() >= max_texts) {
+    texts.erase(lru.back());
+    lru.pop_back();
+  }
+  lru.push_front(utf8);
+  text &txt = texts[utf8];
+  txt.ascii = ascii;
+  txt.lru_pos = lru.begin();
+}
+
+void ascii_cache::set_max_texts(size_t max)
+{
+  max_texts = max;
+  while (texts.size() > max_texts) {
+    texts.erase(lru.back());
+    lru.pop_back();
+  }
+}
+
+thread_local ascii_cache ascii_texts;
+} // namespace
+
+string to_ascii(const string &str)
+{
+  bool is_ascii = true;
+  for (unsigned char c : str)
+    is_ascii = is_ascii && c < 0x80;
+  if (is_ascii)
+    return str;
+
+  const string *cached = ascii_texts.find(str);
+  if (cached)
+    return *cached;
+
+  static thread_local iconvpp::converter conv("ASCII//TRANSLIT", "UTF-8",
+                                              true);
+  static thread_local string ascii; // reused, converting without allocating
+  try {
+    conv.convert(str, ascii);
+  }
+  catch (...) {
+    ascii.clear();
+  }
+  ascii_texts.insert(str, ascii);
+  return ascii;
+}
+
+void set_to_ascii_cache_size(size_t max) { ascii_texts.set_max_texts(max); }
+
 string msg_str(const char *fmt, ...)
 {
   const int MSG_SZ = 256;
@@ -133,6 +133,19 @@ std::string join(InputIt first, InputIt last, std::string delim = " ")
  * \return A pointer to the string. */
 char *clear_extra_whitespace(char *str);
 
+/// Convert UTF-8 text to ASCII
+/** Other characters are transliterated, or dropped if they have no
+ *  transliteration, which depends on the locale. Text that is already
+ *  ASCII is returned as it is, and the conversions of recent other texts
+ *  are cached, for each thread.
+ * \param str the UTF-8 text.
+ * \return The ASCII text. */
+std::string to_ascii(const std::string &str);
+
+/// Set the number of texts held by the to_ascii() cache of this thread
+/** \param max the number of texts, \c 0 for no cache. */
+void set_to_ascii_cache_size(size_t max);
+
 /// Convert a C formated message string to a C++ string
 /** Converts the first MSG_SZ-1 characters of the C format string
  * \param fmt the formatted string
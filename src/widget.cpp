@@ -0,0 +1,62 @@
+/*
+   Copyright (c) 2026, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+#include "widget.h"
+
+fingerprint &fingerprint::add(const void *data, size_t len)
+{
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return *this;
+}
+
+void widget_screen::add(int x, int y, int w, int h, fingerprint_fn fprint,
+                        draw_fn draw)
+{
+  widgets.push_back({x, y, w, h, fprint, draw, 0});
+}
+
+void widget_screen::draw(ArduiPi_OLED &display,
+                         const display_info &disp_info, bool redraw_all)
+{
+  if (redraw_all) {
+    display.clearDisplay();
+    display.addDamage(0, 0, display.width(), display.height());
+  }
+
+  for (auto &wgt : widgets) {
+    const uint64_t fprint = wgt.fprint(disp_info);
+    if (!redraw_all && fprint == wgt.last_fprint)
+      continue;
+    wgt.last_fprint = fprint;
+    if (!redraw_all) {
+      display.fillRect(wgt.x, wgt.y, wgt.w, wgt.h, BLACK);
+      display.addDamage(wgt.x, wgt.y, wgt.w, wgt.h);
+    }
+    wgt.draw(display, disp_info);
+  }
+}
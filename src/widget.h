@@ -0,0 +1,78 @@
+/*
+   Copyright (c) 2026, Adrian Rossiter
+
+   Antiprism - http://www.antiprism.com
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+      The above copyright notice and this permission notice shall be included
+      in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+*/
+
+#ifndef WIDGET_H
+#define WIDGET_H
+
+#include "ArduiPi_OLED.h"
+#include "display_info.h"
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Hash of the values that a widget shows (FNV-1a)
+class fingerprint {
+private:
+  uint64_t hash;
+
+public:
+  fingerprint() : hash(14695981039346656037ULL) {}
+  fingerprint &add(const void *data, size_t len);
+  fingerprint &add(long val) { return add(&val, sizeof(val)); }
+  fingerprint &add(const std::string &str)
+  {
+    return add(str.data(), str.size());
+  }
+  uint64_t get() const { return hash; }
+};
+
+// A screen made of widgets, each drawn within its own box. A widget is
+// drawn again only when its fingerprint changes. Then its box is cleared
+// and redrawn, and the box is added to the display damage.
+class widget_screen {
+public:
+  typedef std::function<uint64_t(const display_info &)> fingerprint_fn;
+  typedef std::function<void(ArduiPi_OLED &, const display_info &)> draw_fn;
+
+  // Add a widget, with box position x, y and size w, h
+  void add(int x, int y, int w, int h, fingerprint_fn fprint, draw_fn draw);
+
+  // Draw the widgets that have changed, or clear the display and draw
+  // them all if redraw_all is set (e.g. when the screen is first shown)
+  void draw(ArduiPi_OLED &display, const display_info &disp_info,
+            bool redraw_all);
+
+private:
+  struct widget {
+    int x, y, w, h;
+    fingerprint_fn fprint;
+    draw_fn draw;
+    uint64_t last_fprint;
+  };
+  std::vector<widget> widgets;
+};
+
+#endif // WIDGET_H